@@ -0,0 +1,59 @@
+//benchmark of the surface tracker: the time of polygonize_seeded split into the evaluations of the
+//function and the rest (lattice tables, cubes and triangles). The function is a torus of radii 0.6 and
+//0.25, plus a negligible triharmonic sum over random centers so that each call costs about what an RBF
+//evaluation does. Usage: polygonizer_bench [voxels per line, 100] [centers, 125] [threads, 1]
+#include "Polygonizer.h"
+#include "../src/xcube_simd.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <atomic>
+using namespace std;
+typedef std::chrono::steady_clock Clock;
+
+static vector<double>cx, cy, cz, w, ux, uy, uz;
+static atomic<long long>n_evals(0), t_evals(0);   //evaluation time in ns, summed over the threads
+
+static double Torus(const R3Pt &in_pt){
+
+    auto t1 = Clock::now();
+    double p[3] = {in_pt[0], in_pt[1], in_pt[2]};
+    double q = sqrt(p[0]*p[0]+p[1]*p[1]) - 0.6;
+    double re = sqrt(q*q+p[2]*p[2]) - 0.25;
+    re += 1e-12*XCubeSIMD::contract(p,cx.data(),cy.data(),cz.data(),w.data(),ux.data(),uy.data(),uz.data(),int(cx.size()));
+    t_evals += std::chrono::nanoseconds(Clock::now() - t1).count();
+    ++n_evals;
+    return re;
+}
+
+static int n_tris = 0, n_verts = 0;
+static int TriProc(int, int, int, VERTICES){++n_tris; return 1;}
+static void VertProc(VERTICES vertices){n_verts = vertices.count;}
+
+int main(int argc, char** argv){
+
+    int n_voxels = argc>1 ? atoi(argv[1]) : 100;
+    int npt = argc>2 ? atoi(argv[2]) : 125;
+    int n_threads = argc>3 ? atoi(argv[3]) : 1;
+
+    srand(0);
+    for(auto v:{&cx,&cy,&cz,&w,&ux,&uy,&uz}){
+        v->assign(XCubeSIMD::padded(npt),0);
+        for(int i=0;i<npt;++i)(*v)[i] = rand()/double(RAND_MAX)-0.5;
+    }
+
+    //the lattice of Surfacer::Surfacing_Implicit for a model of width 2
+    double size = 2./n_voxels;
+    int bounds = int(n_voxels/2*1.75);
+    double seed[3] = {0.85, 0, 0};
+    auto t1 = Clock::now();
+    polygonize_seeded(Torus, NULL, size, bounds, R3Pt(0,0,0), seed, 1, TriProc, VertProc, n_threads);
+    double t_total = std::chrono::nanoseconds(Clock::now() - t1).count()/1e9;
+    double t_eval = t_evals/1e9/n_threads;
+
+    printf("-s %d centers %d threads %d: total %.3f s, evaluation %.3f s (%lld calls), other %.3f s, %d verts %d tris\n",
+           n_voxels, npt, n_threads, t_total, t_eval, n_evals.load(), t_total-t_eval, n_verts, n_tris);
+    return 0;
+}
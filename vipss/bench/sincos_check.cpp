@@ -0,0 +1,61 @@
+//check of MyUtility::sincosArray against std::sin and std::cos: the largest error in ulps of the std
+//result, over uniform x in [-range, range] and the doubles nearest to the multiples of pi/2 in that range
+//(where the argument reduction cancels most). Fails if it is above the bound.
+//Usage: sincos_check [range, 1e5] [uniform samples, 10000000] [bound in ulps, 2]
+#include "../src/utility.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <vector>
+using namespace std;
+
+static double Ulps(double v, double ref){
+    double a = fabs(ref);
+    double ulp = a>0 ? nextafter(a, INFINITY) - a : nextafter(0., 1.);
+    return fabs(v - ref)/ulp;
+}
+
+//the largest error of sin and cos over x, and where it is
+static void Check(const vector<double>&x, double &e_sin, double &e_cos, double &x_sin, double &x_cos){
+    int n = int(x.size());
+    vector<double>s(n), c(n);
+    MyUtility::sincosArray(x.data(), s.data(), c.data(), n);
+    for(int i=0;i<n;++i){
+        double es = Ulps(s[i], sin(x[i])), ec = Ulps(c[i], cos(x[i]));
+        if(es>e_sin){e_sin = es; x_sin = x[i];}
+        if(ec>e_cos){e_cos = ec; x_cos = x[i];}
+    }
+}
+
+int main(int argc, char** argv){
+
+    double range = argc>1 ? atof(argv[1]) : 1e5;
+    int n_uniform = argc>2 ? atoi(argv[2]) : 10000000;
+    double bound = argc>3 ? atof(argv[3]) : 2;
+
+    double e_sin = 0, e_cos = 0, x_sin = 0, x_cos = 0;
+    mt19937_64 gen(7);
+    uniform_real_distribution<double>d(-range, range);
+    vector<double>x(n_uniform);
+    for(auto &v:x)v = d(gen);
+    Check(x, e_sin, e_cos, x_sin, x_cos);
+    printf("uniform in [-%g, %g]: %.3f ulps (sin, x = %.17g), %.3f ulps (cos, x = %.17g)\n",
+           range, range, e_sin, x_sin, e_cos, x_cos);
+
+    double e_sin2 = 0, e_cos2 = 0;
+    x_sin = x_cos = 0;
+    x.clear();
+    for(long long k=-(long long)(range/(my_PI/2)); k<=(long long)(range/(my_PI/2)); ++k){
+        double m = k*(my_PI/2);
+        x.push_back(m);
+        x.push_back(nextafter(m, INFINITY));
+        x.push_back(nextafter(m, -INFINITY));
+    }
+    Check(x, e_sin2, e_cos2, x_sin, x_cos);
+    printf("multiples of pi/2: %.3f ulps (sin, x = %.17g), %.3f ulps (cos, x = %.17g)\n", e_sin2, x_sin, e_cos2, x_cos);
+
+    double e = max(max(e_sin, e_cos), max(e_sin2, e_cos2));
+    printf("%s: %.3f ulps, bound %g\n", e<=bound ? "passed" : "FAILED", e, bound);
+    return e<=bound ? 0 : 1;
+}
@@ -15,19 +15,36 @@ int main(int argc, char** argv)
 
 
 
-    string infilename;
+    string infilename, queryfilename;
     string outpath, pcname, ext, inpath;
 
     int n_voxel_line = 100;
 
     double user_lambda = 0;
 
+    int n_threads = 0;
+    int n_search_threads = 0;
+    int singleprecision = 0;
+    int optbackend = 0;
+    int n_multistart = 1;
+
     bool is_surfacing = false;
     bool is_outputtime = false;
+    bool is_nullspace = false;
+    bool is_iterativeeigen = false;
+    bool is_analyticgrad = false;
+    bool is_gridsurfacing = false;
+    double octree_tol = 0;
+    bool is_streamsurface = false;
+    bool is_voxelsgiven = false;
+    double surf_timebudget = 0;
+    long long surf_evalbudget = 0;
+    int surf_previews = 0;
+    bool is_sdfcache = false;
 
     int c;
     optind=1;
-    while ((c = getopt(argc, argv, "i:o:l:s:t")) != -1) {
+    while ((c = getopt(argc, argv, "i:o:l:s:tj:cep:f:b:m:q:gad:wT:N:P:k")) != -1) {
         switch (c) {
         case 'i':
             infilename = optarg;
@@ -40,17 +57,71 @@ int main(int argc, char** argv)
             break;
         case 's':
             is_surfacing = true;
+            is_voxelsgiven = true;
             n_voxel_line = atoi(optarg);
             break;
         case 't':
             is_outputtime = true;
             break;
+        case 'j':
+            n_threads = atoi(optarg);
+            break;
+        case 'c':
+            is_nullspace = true;
+            break;
+        case 'e':
+            is_iterativeeigen = true;
+            break;
+        case 'p':
+            n_search_threads = atoi(optarg);
+            break;
+        case 'f':
+            singleprecision = atoi(optarg);
+            break;
+        case 'b':
+            optbackend = atoi(optarg);
+            break;
+        case 'm':
+            n_multistart = atoi(optarg);
+            break;
+        case 'q':
+            queryfilename = optarg;
+            break;
+        case 'g':
+            is_analyticgrad = true;
+            break;
+        case 'a':
+            is_gridsurfacing = true;
+            break;
+        case 'd':
+            octree_tol = atof(optarg);
+            break;
+        case 'w':
+            is_streamsurface = true;
+            break;
+        case 'T':
+            is_surfacing = true;
+            surf_timebudget = atof(optarg);
+            break;
+        case 'N':
+            is_surfacing = true;
+            surf_evalbudget = atoll(optarg);
+            break;
+        case 'P':
+            surf_previews = atoi(optarg);
+            break;
+        case 'k':
+            is_sdfcache = true;
+            break;
         case '?':
             cout << "Bad argument setting!" << endl;
             break;
         }
     }
 
+    //with a budget, -s is the highest resolution tried
+    if((surf_timebudget>0 || surf_evalbudget>0) && !is_voxelsgiven)n_voxel_line = 1000;
+
     if(outpath.empty())SplitFileName(infilename,outpath,pcname,ext);
     else SplitFileName(infilename,inpath,pcname,ext);
     cout<<"input file: "<<infilename<<endl;
@@ -66,6 +137,19 @@ int main(int argc, char** argv)
     RBF_Core rbf_core;
     RBF_Paras para = Set_RBF_PARA();
     para.user_lamnbda = user_lambda;
+    para.n_threads = n_threads;
+    para.n_search_threads = n_search_threads;
+    para.singleprecision = singleprecision;
+    para.optbackend = optbackend;
+    para.n_multistart = n_multistart;
+    para.isusenullspace = is_nullspace;
+    para.isusesparse = is_iterativeeigen;
+    para.isanalyticgrad = is_analyticgrad;
+    para.isgridsurfacing = is_gridsurfacing;
+    para.octree_tol = octree_tol;
+    para.surf_timebudget = surf_timebudget;
+    para.surf_evalbudget = surf_evalbudget;
+    para.surf_previews = surf_previews;
 
     readXYZ(infilename,Vs);
     rbf_core.InjectData(Vs,para);
@@ -74,10 +158,22 @@ int main(int argc, char** argv)
     rbf_core.OptNormal(0);
 
     rbf_core.Write_Hermite_NormalPrediction(outpath+pcname+"_normal", 1);
+    if(is_sdfcache)rbf_core.surf_cachename = outpath+pcname+"_sdfcache.bin";
+
+    if(!queryfilename.empty()){
+        vector<double>Qs, values;
+        readXYZ(queryfilename,Qs);
+        rbf_core.Evaluate_Points(Qs,values);
+        writeVecFile(outpath+pcname+"_query",values);
+    }
 
     if(is_surfacing){
-        rbf_core.Surfacing(0,n_voxel_line);
-        rbf_core.Write_Surface(outpath+pcname+"_surface");
+        rbf_core.surf_previewname = outpath+pcname+"_surface";
+        if(is_streamsurface)rbf_core.Surfacing(0,n_voxel_line,outpath+pcname+"_surface");
+        else{
+            rbf_core.Surfacing(0,n_voxel_line);
+            rbf_core.Write_Surface(outpath+pcname+"_surface");
+        }
     }
 
     if(is_outputtime){
@@ -123,6 +219,8 @@ RBF_Paras Set_RBF_PARA(){
 
     para.isusesparse = false;
 
+    para.isusenullspace = false;
+
 
     return para;
 }
@@ -4,6 +4,9 @@
 #include <ctime>
 #include <chrono>
 #include <iomanip>
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
 //#include <eigen3/Eigen/CholmodSupport>
 //#include <gurobi_c++.h>
 
@@ -237,6 +240,376 @@ int Solver::nloptwrapper(vector<double>&lowerbound,
 }
 
 
+static void projectTangent(const vector<double>&x, vector<double>&v){
+    int n = x.size()/3;
+    for(int i=0;i<n;++i){
+        const double *p_x = x.data()+i*3;
+        double *p_v = v.data()+i*3;
+        double d = p_x[0]*p_v[0] + p_x[1]*p_v[1] + p_x[2]*p_v[2];
+        for(int k=0;k<3;++k)p_v[k] -= d*p_x[k];
+    }
+}
+
+static double dotVec(const vector<double>&a, const vector<double>&b){
+    double re = 0;
+    for(size_t i=0;i<a.size();++i)re += a[i]*b[i];
+    return re;
+}
+
+//single objective of sphereLBFGS, as the batch objective of sphereLBFGSBatch
+struct SphereFuncAdaptor{
+    nlopt::vfunc optfunc;
+    void *funcPara;
+};
+
+static void sphereFuncAdaptor(const vector<const vector<double>*>&xs, const vector<vector<double>*>&grads, vector<double>&fs, void *data){
+    SphereFuncAdaptor *adaptor = reinterpret_cast<SphereFuncAdaptor*>(data);
+    for(size_t r=0;r<xs.size();++r)fs[r] = adaptor->optfunc(*xs[r],*grads[r],adaptor->funcPara);
+}
+
+/* L-BFGS on the product of n unit spheres: sol.solveval holds n unit vectors (x[i*3], x[i*3+1], x[i*3+2]).
+ * optfunc returns f and its Euclidean gradient. The Riemannian gradient is its projection on the tangent
+ * planes, a step is retracted by normalizing every vector, and the L-BFGS direction is transported by
+ * projecting it on the tangent planes of the current point. Armijo backtracking line search; stops when
+ * the relative decrease of f is below tor (as ftol_rel of nlopt) or after maxIter evaluations.
+ * Returns the number of iterations. */
+int Solver::sphereLBFGS(nlopt::vfunc optfunc,
+                        void *funcPara,
+                        double tor,
+                        int maxIter,
+                        Solution_Struct &sol,
+                        int n_memory
+                        ){
+
+    SphereFuncAdaptor adaptor{optfunc,funcPara};
+    vector<Solution_Struct>sols(1);
+    sols[0].solveval.swap(sol.solveval);
+    vector<int>iters = sphereLBFGSBatch(sphereFuncAdaptor,&adaptor,tor,maxIter,sols,n_memory);
+    sol = sols[0];
+    return iters[0];
+}
+
+//state of one start of sphereLBFGSBatch
+struct SphereLBFGSState{
+    vector<double>x, g, xn, gn, d, gt;
+    vector<vector<double>>S, Y;
+    vector<double>rho, alpha;
+    int n_pair = 0, head = 0;
+    int neval = 0, iter = 0, n_ls = 0;
+    double f, fn, gd, step;
+    bool issearching = false, isdone = false;
+};
+
+/* sphereLBFGS on k starts in lock step: every round the trial points of all the starts that are not
+ * finished are evaluated by one call of batchfunc, so an objective that is a product with a large
+ * matrix can read the matrix once for all of them. Each start follows exactly the iterations it would
+ * follow alone. Returns the number of iterations of each start. */
+vector<int> Solver::sphereLBFGSBatch(batchvfunc batchfunc,
+                        void *funcPara,
+                        double tor,
+                        int maxIter,
+                        vector<Solution_Struct> &sols,
+                        int n_memory
+                        ){
+
+    auto t1 = Clock::now();
+    int k = sols.size();
+    vector<SphereLBFGSState>st(k);
+    for(int r=0;r<k;++r){
+        SphereLBFGSState &a = st[r];
+        a.x.swap(sols[r].solveval);
+        int dim = a.x.size(), n = dim/3;
+        for(int i=0;i<n;++i){
+            double *p_x = a.x.data()+i*3;
+            double len = sqrt(p_x[0]*p_x[0] + p_x[1]*p_x[1] + p_x[2]*p_x[2]);
+            for(int j=0;j<3;++j)p_x[j] /= len;
+        }
+        a.g.resize(dim); a.xn.resize(dim); a.gn.resize(dim); a.d.resize(dim); a.gt.resize(dim);
+        a.S.assign(n_memory,vector<double>(dim));
+        a.Y.assign(n_memory,vector<double>(dim));
+        a.rho.resize(n_memory); a.alpha.resize(n_memory);
+        sols[r].Statue = 0;
+    }
+
+    vector<const vector<double>*>xs;
+    vector<vector<double>*>grads;
+    vector<double>fs;
+    vector<int>active;
+
+    //f and gradient at the starting points
+    for(int r=0;r<k;++r){xs.push_back(&st[r].x);grads.push_back(&st[r].g);}
+    fs.resize(k);
+    batchfunc(xs,grads,fs,funcPara);
+    for(int r=0;r<k;++r){
+        st[r].f = sols[r].init_energy = fs[r];
+        st[r].neval = 1;
+        projectTangent(st[r].x,st[r].g);
+        if(st[r].neval>=maxIter)st[r].isdone = true;
+    }
+
+    while(true){
+
+        //new search directions for the starts that finished their line search
+        active.clear();
+        for(int r=0;r<k;++r){
+            SphereLBFGSState &a = st[r];
+            if(a.isdone)continue;
+            if(!a.issearching){
+                int dim = a.x.size(), n = dim/3;
+                vector<double>&d = a.d;
+
+                //two loop recursion, newest pair at (head-1)
+                d = a.g;
+                for(int j=0;j<a.n_pair;++j){
+                    int ind = (a.head-1-j+n_memory)%n_memory;
+                    a.alpha[ind] = a.rho[ind]*dotVec(a.S[ind],d);
+                    for(int i=0;i<dim;++i)d[i] -= a.alpha[ind]*a.Y[ind][i];
+                }
+                if(a.n_pair>0){
+                    int ind = (a.head-1+n_memory)%n_memory;
+                    double gamma = dotVec(a.S[ind],a.Y[ind]) / dotVec(a.Y[ind],a.Y[ind]);
+                    for(auto &v:d)v *= gamma;
+                }
+                for(int j=a.n_pair-1;j>=0;--j){
+                    int ind = (a.head-1-j+n_memory)%n_memory;
+                    double beta = a.rho[ind]*dotVec(a.Y[ind],d);
+                    for(int i=0;i<dim;++i)d[i] += (a.alpha[ind]-beta)*a.S[ind][i];
+                }
+                for(auto &v:d)v = -v;
+                projectTangent(a.x,d);
+
+                a.gd = dotVec(a.g,d);
+                if(a.gd>=0){
+                    //not a descent direction, restart from the gradient
+                    a.n_pair = 0;
+                    for(int i=0;i<dim;++i)d[i] = -a.g[i];
+                    a.gd = dotVec(a.g,d);
+                }
+                if(a.gd==0){
+                    sols[r].Statue = 1;
+                    a.isdone = true;
+                    continue;
+                }
+
+                //the first step turns the normals by at most ~0.1 rad
+                a.step = 1;
+                if(a.n_pair==0){
+                    double maxd = 0;
+                    for(int i=0;i<n;++i)maxd = max(maxd,sqrt(d[i*3]*d[i*3]+d[i*3+1]*d[i*3+1]+d[i*3+2]*d[i*3+2]));
+                    a.step = min(1.0,0.1/maxd);
+                }
+                a.n_ls = 0;
+                a.issearching = true;
+            }
+
+            //trial point
+            int n = a.x.size()/3;
+            for(int i=0;i<n;++i){
+                double *p_xn = a.xn.data()+i*3;
+                for(int j=0;j<3;++j)p_xn[j] = a.x[i*3+j] + a.step*a.d[i*3+j];
+                double len = sqrt(p_xn[0]*p_xn[0] + p_xn[1]*p_xn[1] + p_xn[2]*p_xn[2]);
+                for(int j=0;j<3;++j)p_xn[j] /= len;
+            }
+            active.push_back(r);
+        }
+        if(active.empty())break;
+
+        xs.clear();grads.clear();
+        for(auto r:active){xs.push_back(&st[r].xn);grads.push_back(&st[r].gn);}
+        fs.resize(active.size());
+        batchfunc(xs,grads,fs,funcPara);
+
+        for(size_t ia=0;ia<active.size();++ia){
+            int r = active[ia];
+            SphereLBFGSState &a = st[r];
+            a.fn = fs[ia];
+            ++a.neval;
+            ++a.n_ls;
+            if(!(a.fn <= a.f + 1e-4*a.step*a.gd)){
+                a.step *= 0.5;
+                if(a.n_ls>=40 || a.neval>=maxIter)a.isdone = true;
+                continue;
+            }
+            a.issearching = false;
+            ++a.iter;
+            int dim = a.x.size();
+            projectTangent(a.xn,a.gn);
+
+            //s and y transported to the tangent planes of xn by projection
+            vector<double>&s = a.S[a.head], &y = a.Y[a.head];
+            for(int i=0;i<dim;++i)s[i] = a.step*a.d[i];
+            projectTangent(a.xn,s);
+            a.gt = a.g;
+            projectTangent(a.xn,a.gt);
+            for(int i=0;i<dim;++i)y[i] = a.gn[i] - a.gt[i];
+            double sy = dotVec(s,y);
+            if(sy>1e-20){
+                a.rho[a.head] = 1/sy;
+                a.head = (a.head+1)%n_memory;
+                a.n_pair = min(a.n_pair+1,n_memory);
+            }
+
+            double fold = a.f;
+            a.x.swap(a.xn);
+            a.g.swap(a.gn);
+            a.f = a.fn;
+            if(fabs(fold-a.f) <= tor*0.5*(fabs(fold)+fabs(a.f))){
+                sols[r].Statue = 1;
+                a.isdone = true;
+            }else if(a.neval>=maxIter)a.isdone = true;
+        }
+    }
+
+    double time = std::chrono::nanoseconds(Clock::now() - t1).count()/1e9;
+    vector<int>iters(k);
+    for(int r=0;r<k;++r){
+        sols[r].solveval.swap(st[r].x);
+        sols[r].energy = st[r].f;
+        sols[r].time = time;
+        iters[r] = st[r].iter;
+        cout<<"sphere L-BFGS time: "<<time<<" iterations: "<<st[r].iter<<" evaluations: "<<st[r].neval<<endl;
+        std::cout << "Obj: "<< std::setprecision(10) << sols[r].init_energy << " -> " <<sols[r].energy << std::endl;
+    }
+
+    return iters;
+}
+
+
+/* Lanczos with full reorthogonalization for the smallest eigenpair of a symmetric K.
+ * With isshiftinvert, it runs on (K+shift*I)^-1 through one Cholesky factorization of K+shift*I,
+ * which is reused by every iteration; otherwise it runs on -K directly (no factorization, slower
+ * convergence). The Krylov space is restarted from the current Ritz vector every 'nkrylov' steps
+ * until the relative residual ||K x - eigval x|| / ||K x|| drops below tor. Returns 1 if it did
+ * (0 after maxIter iterations). */
+int Solver::smallestEigenpair(const arma::mat &K,
+                              double &eigval,
+                              arma::vec &eigvec,
+                              double tor,
+                              int maxIter,
+                              bool isshiftinvert
+                              ){
+
+    int n = K.n_rows;
+    const int nkrylov = min(n, 40);
+
+    auto t1 = Clock::now();
+
+    arma::mat R;
+    double shift = 0;
+    if(isshiftinvert){
+        double tr = 0;
+        for(int i=0;i<n;++i)tr += fabs(K(i,i));
+        shift = 1e-10*tr/n;
+        arma::mat Ks = K;
+        for(int k=0;k<20;++k){
+            for(int i=0;i<n;++i)Ks(i,i) = K(i,i) + shift;
+            if(chol(R,Ks))break;
+            shift *= 10;
+        }
+        if(R.n_rows!=n){
+            cout<<"smallestEigenpair: shift-invert failed, fall back to plain Lanczos"<<endl;
+            isshiftinvert = false;
+        }
+    }
+
+    //y = A x, A = (K+shift*I)^-1 as R\(R'\x) with upper triangular R, or A = -K
+    auto applyOp = [&](const arma::vec &x, arma::vec &y){
+        if(!isshiftinvert){
+            y = -(K*x);
+            return;
+        }
+        y = x;
+        double *p_y = y.memptr();
+        for(int i=0;i<n;++i){
+            const double *p_col = R.colptr(i);
+            double s = p_y[i];
+            for(int k=0;k<i;++k)s -= p_col[k]*p_y[k];
+            p_y[i] = s/p_col[i];
+        }
+        for(int j=n-1;j>=0;--j){
+            const double *p_col = R.colptr(j);
+            p_y[j] /= p_col[j];
+            double yj = p_y[j];
+            for(int k=0;k<j;++k)p_y[k] -= p_col[k]*yj;
+        }
+    };
+
+    arma::vec x(n);
+    unsigned int seed = 1;
+    for(int i=0;i<n;++i){
+        seed = seed * 1103515245u + 12345u;
+        x(i) = double((seed>>16)&32767)/32767. - 0.5;
+    }
+    x /= arma::norm(x);
+
+    arma::mat Q(n,nkrylov+1);
+    arma::vec w, Kx;
+    double relres = 1;
+    int iter = 0, nrestart = 0;
+    while(iter<maxIter){
+
+        vector<double>alpha, beta;
+        Q.col(0) = x;
+        int m = 0;
+        for(;m<nkrylov && iter<maxIter;++m,++iter){
+            applyOp(Q.col(m),w);
+            alpha.push_back(arma::dot(w,Q.col(m)));
+            for(int pass=0;pass<2;++pass){
+                arma::vec c = Q.cols(0,m).t()*w;
+                w -= Q.cols(0,m)*c;
+            }
+            double bnorm = arma::norm(w);
+            beta.push_back(bnorm);
+            if(bnorm<1e-14*fabs(alpha.back())){++m;++iter;break;}
+            Q.col(m+1) = w/bnorm;
+        }
+
+        arma::mat T;
+        T.zeros(m,m);
+        for(int i=0;i<m;++i){
+            T(i,i) = alpha[i];
+            if(i+1<m)T(i,i+1) = T(i+1,i) = beta[i];
+        }
+        arma::vec tval;
+        arma::mat tvec;
+        eig_sym(tval,tvec,T);
+
+        x = Q.cols(0,m-1)*tvec.col(m-1);
+        x /= arma::norm(x);
+        Kx = K*x;
+        eigval = arma::dot(x,Kx);
+        relres = arma::norm(Kx-eigval*x)/max(arma::norm(Kx),1e-300);
+        ++nrestart;
+        if(relres<tor)break;
+    }
+
+    eigvec = x;
+    cout<<"smallestEigenpair: "<<eigval<<" residual: "<<relres<<" iterations: "<<iter<<" restarts: "<<nrestart
+       <<" time: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+
+    return relres<tor;
+}
+
+
+
+//sets the number of threads of the BLAS armadillo is linked to, looked up at runtime since the
+//call is specific to each implementation (OpenBLAS, MKL). Returns false if none is found
+bool Solver::setBLASThreads(int n_threads){
+
+#ifndef _WIN32
+    const char *names[] = {"openblas_set_num_threads", "MKL_Set_Num_Threads"};
+    for(auto name:names){
+        void *func = dlsym(RTLD_DEFAULT, name);
+        if(func!=NULL){
+            reinterpret_cast<void(*)(int)>(func)(n_threads);
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+
 
 
 
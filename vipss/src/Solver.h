@@ -65,6 +65,9 @@ struct NLOptConstraint{
 };
 
 
+//evaluates k points in one call: fs[r] = f(*xs[r]) and *grads[r] its gradient
+typedef void (*batchvfunc)(const vector<const vector<double>*> &xs, const vector<vector<double>*> &grads, vector<double> &fs, void *data);
+
 struct Solution_Struct{
     int Statue;
     double init_energy;
@@ -134,6 +137,32 @@ public:
                    Solution_Struct &sol
                    );
 
+    static int smallestEigenpair(const arma::mat &K,
+                   double &eigval,
+                   arma::vec &eigvec,
+                   double tor,
+                   int maxIter,
+                   bool isshiftinvert = true
+                   );
+
+    static int sphereLBFGS(nlopt::vfunc optfunc,
+                   void *funcPara,
+                   double tor,
+                   int maxIter,
+                   Solution_Struct &sol,
+                   int n_memory = 10
+                   );
+
+    static vector<int> sphereLBFGSBatch(batchvfunc batchfunc,
+                   void *funcPara,
+                   double tor,
+                   int maxIter,
+                   vector<Solution_Struct> &sols,
+                   int n_memory = 10
+                   );
+
+    static bool setBLASThreads(int n_threads);
+
 };
 
 
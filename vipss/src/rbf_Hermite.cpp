@@ -1,6 +1,7 @@
 #include "rbfcore.h"
 #include "utility.h"
 #include "Solver.h"
+#include "xcube_simd.h"
 #include <armadillo>
 #include <fstream>
 #include <limits>
@@ -10,6 +11,7 @@
 #include <iomanip>
 #include <algorithm>
 #include <queue>
+#include <random>
 #include "readers.h"
 //#include "mymesh/UnionFind.h"
 //#include "mymesh/tinyply.h"
@@ -84,6 +86,62 @@ bool RBF_Core::Write_Hermite_NormalPrediction(string fname, int mode){
 
 
 
+//M is assembled in TILE x TILE tiles of point pairs, only tiles with bj>=bi are visited
+//and each pair (i<=j) writes its kernel, gradient and hessian entries for both (i,j) and (j,i).
+//The kernel is radial, so G(pj,pi) = -G(pi,pj) and H(pj,pi) = H(pi,pj). A column j of a tile is
+//evaluated against the rows of the tile by one Kernel_ValueGradHessian call (the gradient is taken
+//in pj, so G(pi,pj) = -G)
+template <class Kernel>
+static void Hermite_AssembleM(const Kernel &ker, const vector<double>&pts, arma::mat &M, int n_threads){
+
+    const int TILE = 64;
+    int npt = pts.size()/3;
+    int ntile = (npt+TILE-1)/TILE;
+    vector<pair<int,int>>tiles;
+    for(int bi=0;bi<ntile;++bi)for(int bj=bi;bj<ntile;++bj)tiles.emplace_back(bi,bj);
+
+    const double *p_pts = pts.data();
+    double *p_M = M.memptr();
+    const size_t ld = npt*4;
+    vector<double>cx(npt), cy(npt), cz(npt);
+    for(int i=0;i<npt;++i){
+        cx[i] = pts[i*3];
+        cy[i] = pts[i*3+1];
+        cz[i] = pts[i*3+2];
+    }
+    auto assemble_tile = [&](int t, int){
+        int ibe = tiles[t].first*TILE, ied = min(ibe+TILE,npt);
+        int jbe = tiles[t].second*TILE, jed = min(jbe+TILE,npt);
+        double K[TILE], G[TILE*3], H[TILE*6];
+        const int hind[9] = {0,1,2,1,3,4,2,4,5};
+        for(int j=jbe;j<jed;++j){
+            int n = min(ied,j+1) - ibe;
+            if(n<=0)continue;
+            Kernel_ValueGradHessian(ker, p_pts+j*3, cx.data()+ibe, cy.data()+ibe, cz.data()+ibe, n, K, G, H);
+            for(int l=0;l<n;++l){
+                int i = ibe+l;
+                p_M[i+j*ld] = p_M[j+i*ld] = K[l];
+                for(int k=0;k<3;++k){
+                    size_t jind = npt+j+k*npt;
+                    p_M[i+jind*ld] = p_M[jind+i*ld] = -G[l+k*n];
+                }
+                if(i!=j)for(int k=0;k<3;++k){
+                    size_t iind = npt+i+k*npt;
+                    p_M[j+iind*ld] = p_M[iind+j*ld] = G[l+k*n];
+                }
+                for(int k=0;k<3;++k){
+                    size_t iind = npt+i+k*npt;
+                    for(int m=0;m<3;++m){
+                        size_t jind = npt+j+m*npt;
+                        p_M[jind+iind*ld] = p_M[iind+jind*ld] = -H[l+hind[k*3+m]*n];
+                    }
+                }
+            }
+        }
+    };
+    MyUtility::parallelFor(tiles.size(), n_threads, assemble_tile);
+}
+
 void RBF_Core::Set_HermiteRBF(vector<double>&pts){
 
     cout<<"Set_HermiteRBF"<<endl;
@@ -92,48 +150,14 @@ void RBF_Core::Set_HermiteRBF(vector<double>&pts){
 
     a.set_size(npt*4);
     M.set_size(npt*4,npt*4);
-    double *p_pts = pts.data();
-    for(int i=0;i<npt;++i){
-        for(int j=i;j<npt;++j){
-            M(i,j) = M(j,i) = Kernal_Function_2p(p_pts+i*3, p_pts+j*3);
-        }
-    }
 
-
-    //if(User_Lamnbda!=0)for(int i=0;i<npt;++i)M(i,i) += User_Lamnbda;
-
-
-    double G[3];
-    for(int i=0;i<npt;++i){
-        for(int j=0;j<npt;++j){
-
-            Kernal_Gradient_Function_2p(p_pts+i*3, p_pts+j*3, G);
-            //            int jind = j*3+npt;
-            //            for(int k=0;k<3;++k)M(i,jind+k) = -G[k];
-            //            for(int k=0;k<3;++k)M(jind+k,i) = G[k];
-
-            for(int k=0;k<3;++k)M(i,npt+j+k*npt) = G[k];
-            for(int k=0;k<3;++k)M(npt+j+k*npt,i) = G[k];
-
-        }
-    }
-
-    double H[9];
-    for(int i=0;i<npt;++i){
-        for(int j=i;j<npt;++j){
-
-            Kernal_Hessian_Function_2p(p_pts+i*3, p_pts+j*3, H);
-            //            int iind = i*3+npt;
-            //            int jind = j*3+npt;
-            //            for(int k=0;k<3;++k)
-            //                for(int l=0;l<3;++l)
-            //                    M(jind+l,iind+k) = M(iind+k,jind+l) = -H[k*3+l];
-
-            for(int k=0;k<3;++k)
-                for(int l=0;l<3;++l)
-                    M(npt+j+l*npt,npt+i+k*npt) = M(npt+i+k*npt,npt+j+l*npt) = -H[k*3+l];
-        }
+    auto t1 = Clock::now();
+    switch(kernal){
+    case ThinSpline: Hermite_AssembleM(ThinSpline_Policy(),pts,M,n_threads); break;
+    case Gaussian: Hermite_AssembleM(Gaussian_Policy(kernal_sigma),pts,M,n_threads); break;
+    default: Hermite_AssembleM(XCube_Policy(),pts,M,n_threads); break;
     }
+    cout<<"assemble M ("<<n_threads<<" threads, "<<mp_RBF_Kernal[kernal]<<(kernal==XCube ? string(" ")+XCubeSIMD::levelName() : string())<<"): "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
 
     //cout<<std::setprecision(5)<<std::fixed<<M<<endl;
 
@@ -159,7 +183,7 @@ void RBF_Core::Set_HermiteRBF(vector<double>&pts){
 
     if(!isnewformula){
         cout<<"start solve M: "<<endl;
-        auto t1 = Clock::now();
+        t1 = Clock::now();
         if(isinv)Minv = inv(M);
         else {
             arma::mat Eye;
@@ -213,18 +237,19 @@ void RBF_Core::Set_User_Lamnda_ToMatrix(double user_ls){
         Set_Actual_User_LSCoef(user_ls);
         auto t1 = Clock::now();
         cout<<"setting K, HermiteApprox_Lamnda"<<endl;
+        //finalH is the only copy of the matrix, K is filled only by Set_HermiteApprox_Lamnda
+        K.reset();
         if(User_Lamnbda>0){
-            arma::sp_mat eye;
-            eye.eye(npt,npt);
-
-            dI = inv(eye + User_Lamnbda*K00);
-            saveK_finalH = K = K11 - (User_Lamnbda)*(K01.t()*dI*K01);
+            Set_K00_Spectral();
+            arma::mat KUser;
+            Get_Lamnbda_K(User_Lamnbda,KUser);
+            finalH.pack(KUser);
 
-        }else saveK_finalH = K = K11;
+        }else finalH.pack(K11);
         cout<<"solved: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
     }
 
-    finalH = saveK_finalH;
+    Set_FinalH_Single();
 
 }
 
@@ -236,23 +261,142 @@ void RBF_Core::Set_HermiteApprox_Lamnda(double hermite_ls){
         auto t1 = Clock::now();
         cout<<"setting K, HermiteApprox_Lamnda"<<endl;
         if(ls_coef>0){
-            arma::sp_mat eye;
-            eye.eye(npt,npt);
-
-            if(ls_coef > 0){
-                arma:: mat tmpdI = inv(eye + (ls_coef+User_Lamnbda)*K00);
-                K = K11 - (ls_coef+User_Lamnbda)*(K01.t()*tmpdI*K01);
-            }else{
-                K = saveK_finalH;
-            }
-        }
+            Set_K00_Spectral();
+            Get_HermiteApprox_K(ls_coef,K);
+        }else K.reset();
         cout<<"solved: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;    
     }
 
 
 }
 
+//K of the Hermite approximation with weight hermite_ls; only reads the K blocks and finalH, so it is
+//safe to call concurrently with different outputs. hermite_ls<=0 gives finalH
+void RBF_Core::Get_HermiteApprox_K(double hermite_ls, arma::mat &Kout){
+
+    if(hermite_ls<=0)finalH.unpack(Kout);
+    else Get_Lamnbda_K(hermite_ls+User_Lamnbda,Kout);
+}
+
+//K00 = V diag(d) V', so (I + lamnbda*K00)^-1 = V diag(1/(1+lamnbda*d)) V'. The decomposition and
+//W = V'*K01 are computed once, after that every lamnbda costs one GEMM instead of an inverse
+void RBF_Core::Set_K00_Spectral(){
+
+    if(isK00_spectral || isK00_spectralfailed)return;
+    auto t1 = Clock::now();
+    //K00 comes out of an inverse and is symmetric only up to roundoff
+    arma::mat K00s = (K00 + K00.t())/2;
+    if(!eig_sym(K00_d, K00_V, K00s)){
+        cout<<"Set_K00_Spectral: eig_sym failed, K is solved for every lamnbda"<<endl;
+        isK00_spectralfailed = true;
+        return;
+    }
+    K00_W = K00_V.t()*K01;
+    isK00_spectral = true;
+    cout<<"K00 spectral: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+}
+
+//Kout = K11 - lamnbda * K01'*(I + lamnbda*K00)^-1*K01, read only, so Set_K00_Spectral is called
+//beforehand; falls back to a solve if the decomposition is not available
+void RBF_Core::Get_Lamnbda_K(double lamnbda, arma::mat &Kout){
+
+    if(!isK00_spectral){
+        arma::mat eye;
+        eye.eye(npt,npt);
+        Kout = K11 - lamnbda*(K01.t()*solve(eye + lamnbda*K00, K01));
+        return;
+    }
+    arma::mat sW = K00_W;
+    sW.each_col() %= lamnbda / (1 + lamnbda*K00_d);
+    Kout = K11 - K00_W.t()*sW;
+}
+
+
+
+//Householder QR of the polynomial block N (4n x 4): Q = H_0 H_1 H_2 H_3, H_k = I - beta_k v_k v_k',
+//the first 4 columns of Q span range(N) and the rest is an orthonormal basis Z of null(N')
+static void Householder_PolyBasis(const arma::mat &N, arma::mat &V, arma::vec &beta){
+
+    int m = N.n_rows, nc = N.n_cols;
+    arma::mat R = N;
+    V.zeros(m,nc);
+    beta.zeros(nc);
+    for(int k=0;k<nc;++k){
+        double xnorm = 0;
+        for(int i=k;i<m;++i)xnorm += R(i,k)*R(i,k);
+        xnorm = sqrt(xnorm);
+        double alpha = R(k,k) > 0 ? -xnorm : xnorm;
+        for(int i=k;i<m;++i)V(i,k) = R(i,k);
+        V(k,k) -= alpha;
+        double vv = 0;
+        for(int i=k;i<m;++i)vv += V(i,k)*V(i,k);
+        if(vv==0)continue;
+        beta(k) = 2./vv;
+        for(int j=k;j<nc;++j){
+            double s = 0;
+            for(int i=k;i<m;++i)s += V(i,k)*R(i,j);
+            s *= beta(k);
+            for(int i=k;i<m;++i)R(i,j) -= s*V(i,k);
+        }
+    }
+}
+
+//X <- H X H for symmetric X and H = I - beta v v', as the rank-2 update X - v u' - u v'
+static void Householder_SymUpdate(arma::mat &X, const arma::vec &v, double beta, int n_threads){
+
+    if(beta==0)return;
+    int m = X.n_rows;
+    arma::vec w = X*v;
+    arma::vec u = beta*w - (0.5*beta*beta*arma::dot(v,w))*v;
+    const double *p_v = v.memptr(), *p_u = u.memptr();
+    double *p_X = X.memptr();
+    MyUtility::parallelFor(m, n_threads, [&](int j, int){
+        double *p_col = p_X+size_t(j)*m;
+        for(int i=0;i<m;++i)p_col[i] -= p_v[i]*p_u[j] + p_u[i]*p_v[j];
+    });
+}
 
+//Nullspace-projected solve of the saddle point system [M N; N' 0]:
+//its upper-left inverse block is Z (Z'MZ)^-1 Z', where Z'MZ is positive definite for the conditionally
+//positive definite kernels, so a Cholesky based inverse replaces the LU inverse of the (4n+4)^2 matrix.
+//Only K00, K01, K11 are kept, the coefficients are recovered from them in Set_RBFCoef.
+bool RBF_Core::Set_Hermite_NullspaceK(){
+
+    int m = npt*4;
+    arma::mat V;
+    arma::vec beta;
+    Householder_PolyBasis(N,V,beta);
+
+    MN = M*N;
+    NtN = N.t()*N;
+
+    auto t2 = Clock::now();
+    for(int k=0;k<4;++k)Householder_SymUpdate(M,arma::vec(V.col(k)),beta(k),n_threads);
+    arma::mat S = M.submat(4,4,m-1,m-1);
+    M.clear();
+
+    arma::mat Sinv;
+    if(!inv_sympd(Sinv,S)){
+        //M was overwritten by the updates and released, the full inverse needs it again
+        cout<<"Z'MZ is not positive definite, fall back to the full inverse"<<endl;
+        S.clear();
+        Set_HermiteRBF(pts);
+        return false;
+    }
+    S.clear();
+
+    arma::mat Kfull;
+    Kfull.zeros(m,m);
+    Kfull.submat(4,4,m-1,m-1) = Sinv;
+    Sinv.clear();
+    for(int k=3;k>=0;--k)Householder_SymUpdate(Kfull,arma::vec(V.col(k)),beta(k),n_threads);
+    cout<<"nullspace inverse: "<<std::chrono::nanoseconds(Clock::now() - t2).count()/1e9<<endl;
+
+    K00 = Kfull.submat(0,0,npt-1,npt-1);
+    K01 = Kfull.submat(0,npt,npt-1,npt*4-1);
+    K11 = Kfull.submat( npt, npt, npt*4-1, npt*4-1 );
+    return true;
+}
 
 void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 
@@ -262,15 +406,25 @@ void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 
     auto t1 = Clock::now();
     cout<<"setting K"<<endl;
+    isK00_spectral = isK00_spectralfailed = false;
 
 
     if(!isnewformula){
         arma::mat D = N.t()*Minv;
         K = Minv - D.t()*inv(D*N)*D;
-        K = K.submat( npt, npt, npt*4-1, npt*4-1 );
-        finalH = saveK_finalH = K;
+        finalH.pack(K.submat( npt, npt, npt*4-1, npt*4-1 ));
+        K.reset();
+        Set_FinalH_Single();
 
+    }else if(isuse_nullspace && Set_Hermite_NullspaceK()){
+
+        cout<<"K11: "<<K11.n_cols<<endl;
+
+        Set_User_Lamnda_ToMatrix(User_Lamnbda_inject);
+
+        cout<<"K: "<<finalH.n<<endl;
     }else{
+        isuse_nullspace = false;
         cout<<"using new formula"<<endl;
         bigM.zeros((npt+1)*4,(npt+1)*4);
         bigM.submat(0,0,npt*4-1,npt*4-1) = M;
@@ -288,10 +442,9 @@ void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 
         bigMinv.clear();
         //K = Minv - Ninv *(N.t()*Minv);
-        K = Minv;
-        K00 = K.submat(0,0,npt-1,npt-1);
-        K01 = K.submat(0,npt,npt-1,npt*4-1);
-        K11 = K.submat( npt, npt, npt*4-1, npt*4-1 );
+        K00 = Minv.submat(0,0,npt-1,npt-1);
+        K01 = Minv.submat(0,npt,npt-1,npt*4-1);
+        K11 = Minv.submat( npt, npt, npt*4-1, npt*4-1 );
 
         M.clear();N.clear();
         cout<<"K11: "<<K11.n_cols<<endl;
@@ -307,7 +460,7 @@ void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 //		ny = eig_sym( eigval, eigvec, K);
 //		cout<<ny<<endl;
 
-        cout<<"K: "<<K.n_cols<<endl;
+        cout<<"K: "<<finalH.n<<endl;
     }
 
 
@@ -330,18 +483,36 @@ void RBF_Core::SetInitnormal_Uninorm(){
 
 int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(){
 
+    if(!K.is_empty())Solve_Hermite_PredictNormal_UnitNorm(K,initnormals);
+    else{
+        arma::mat Kbuf;
+        finalH.unpack(Kbuf);
+        Solve_Hermite_PredictNormal_UnitNorm(Kbuf,initnormals);
+    }
+    SetInitnormal_Uninorm();
+    cout<<"Solve_Hermite_PredictNormal_UnitNorm finish"<<endl;
+    return 1;
+}
+
+int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(const arma::mat &Kin, vector<double> &init_normals){
+
     arma::vec eigval, ny;
     arma::mat eigvec;
 
     if(!isuse_sparse){
-        ny = eig_sym( eigval, eigvec, K);
+        ny = eig_sym( eigval, eigvec, Kin);
     }else{
-//		cout<<"use sparse eigen"<<endl;
-//        int k = 4;
-//        do{
-//            ny = eigs_sym( eigval, eigvec, sp_K, k, "sa" );
-//            k+=4;
-//        }while(ny(0)==0);
+        //only the smallest eigenpair is used, sparse_para is the residual tolerance
+        double eig0;
+        arma::vec vec0;
+        if(Solver::smallestEigenpair(Kin, eig0, vec0, sparse_para, 2000, true)){
+            eigval.set_size(1);
+            eigval(0) = eig0;
+            eigvec = vec0;
+        }else{
+            cout<<"smallestEigenpair did not converge, fall back to eig_sym"<<endl;
+            ny = eig_sym( eigval, eigvec, Kin);
+        }
     }
 
 
@@ -349,20 +520,17 @@ int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(){
 
     int smalleig = 0;
 
-    initnormals.resize(npt*3);
+    init_normals.resize(npt*3);
     arma::vec y(npt*4);
     for(int i=0;i<npt;++i)y(i) = 0;
     for(int i=0;i<npt*3;++i)y(i+npt) = eigvec(i,smalleig);
     for(int i=0;i<npt;++i){
-        initnormals[i*3]   = y(npt+i);
-        initnormals[i*3+1] = y(npt+i+npt);
-        initnormals[i*3+2] = y(npt+i+npt*2);
+        init_normals[i*3]   = y(npt+i);
+        init_normals[i*3+1] = y(npt+i+npt);
+        init_normals[i*3+2] = y(npt+i+npt*2);
         //MyUtility::normalize(normals.data()+i*3);
     }
 
-
-    SetInitnormal_Uninorm();
-    cout<<"Solve_Hermite_PredictNormal_UnitNorm finish"<<endl;
     return 1;
 }
 
@@ -370,64 +538,61 @@ int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(){
 
 /***************************************************************************************************/
 /***************************************************************************************************/
-double acc_time;
+void Hermite_OptContext::init(const SymMatrix *H, int npt, int n_threads){
+
+    this->H = H;
+    this->npt = npt;
+    this->n_threads = n_threads;
+    countopt = 0;
+    countbatch = 0;
+    acc_time = 0;
+    sinx.resize(npt*2);
+    cosx.resize(npt*2);
+    x3.resize(npt*3);
+    Hx.resize(npt*3);
+}
 
-static int countopt = 0;
 double optfunc_Hermite(const vector<double>&x, vector<double>&grad, void *fdata){
 
     auto t1 = Clock::now();
-    RBF_Core *drbf = reinterpret_cast<RBF_Core*>(fdata);
-    int n = drbf->npt;
-    arma::vec arma_x(n*3);
+    Hermite_OptContext *ctx = reinterpret_cast<Hermite_OptContext*>(fdata);
+    int n = ctx->npt;
+    const double *p_sin = ctx->sinx.data(), *p_cos = ctx->cosx.data();
+    double *p_x = ctx->x3.data();
 
     //(  sin(a)cos(b), sin(a)sin(b), cos(a)  )  a =>[0, pi], b => [-pi, pi];
-    vector<double>sina_cosa_sinb_cosb(n * 4);
+    MyUtility::sincosArray(x.data(), ctx->sinx.data(), ctx->cosx.data(), n*2);
     for(int i=0;i<n;++i){
-        int ind = i*4;
-        sina_cosa_sinb_cosb[ind] = sin(x[i*2]);
-        sina_cosa_sinb_cosb[ind+1] = cos(x[i*2]);
-        sina_cosa_sinb_cosb[ind+2] = sin(x[i*2+1]);
-        sina_cosa_sinb_cosb[ind+3] = cos(x[i*2+1]);
+        p_x[i] = p_sin[i*2] * p_cos[i*2+1];
+        p_x[i+n] = p_sin[i*2] * p_sin[i*2+1];
+        p_x[i+n*2] = p_cos[i*2];
     }
 
-    for(int i=0;i<n;++i){
-        auto p_scsc = sina_cosa_sinb_cosb.data()+i*4;
-        //        int ind = i*3;
-        //        arma_x(ind) = p_scsc[0] * p_scsc[3];
-        //        arma_x(ind+1) = p_scsc[0] * p_scsc[2];
-        //        arma_x(ind+2) = p_scsc[1];
-        arma_x(i) = p_scsc[0] * p_scsc[3];
-        arma_x(i+n) = p_scsc[0] * p_scsc[2];
-        arma_x(i+n*2) = p_scsc[1];
-    }
-
-    arma::vec a2;
     //if(drbf->isuse_sparse)a2 = drbf->sp_H * arma_x;
     //else
-    a2 = drbf->finalH * arma_x;
-
+    ctx->H->symv(p_x, ctx->Hx.data(), ctx->n_threads, ctx->symv_work);
+    const double *p_a2 = ctx->Hx.data();
 
+    //energy x'Hx and its gradient w.r.t. the angles in one pass
+    double re = 0;
     if (!grad.empty()) {
 
         grad.resize(n*2);
-
+        double *p_grad = grad.data();
         for(int i=0;i<n;++i){
-            auto p_scsc = sina_cosa_sinb_cosb.data()+i*4;
-
-            //            int ind = i*3;
-            //            grad[i*2] = a2(ind) * p_scsc[1] * p_scsc[3] + a2(ind+1) * p_scsc[1] * p_scsc[2] - a2(ind+2) * p_scsc[0];
-            //            grad[i*2+1] = -a2(ind) * p_scsc[0] * p_scsc[2] + a2(ind+1) * p_scsc[0] * p_scsc[3];
-
-            grad[i*2] = a2(i) * p_scsc[1] * p_scsc[3] + a2(i+n) * p_scsc[1] * p_scsc[2] - a2(i+n*2) * p_scsc[0];
-            grad[i*2+1] = -a2(i) * p_scsc[0] * p_scsc[2] + a2(i+n) * p_scsc[0] * p_scsc[3];
-
+            double sina = p_sin[i*2], cosa = p_cos[i*2], sinb = p_sin[i*2+1], cosb = p_cos[i*2+1];
+            double a0 = p_a2[i], a1 = p_a2[i+n], a2 = p_a2[i+n*2];
+            re += p_x[i]*a0 + p_x[i+n]*a1 + p_x[i+n*2]*a2;
+            p_grad[i*2] = a0 * cosa * cosb + a1 * cosa * sinb - a2 * sina;
+            p_grad[i*2+1] = -a0 * sina * sinb + a1 * sina * cosb;
         }
+    }else{
+        for(int i=0;i<n*3;++i)re += p_x[i]*p_a2[i];
     }
 
-    double re = arma::dot( arma_x, a2 );
-    countopt++;
+    ctx->countopt++;
 
-    acc_time+=(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9);
+    ctx->acc_time+=(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9);
 
     //cout<<countopt++<<' '<<re<<endl;
     return re;
@@ -436,23 +601,122 @@ double optfunc_Hermite(const vector<double>&x, vector<double>&grad, void *fdata)
 
 
 
+void RBF_Core::Set_FinalH_Single(){
+
+    if(singleprecision>0)finalH_single.packSingle(finalH);
+    else finalH_single.clear();
+}
+
 int RBF_Core::Opt_Hermite_PredictNormal_UnitNormal(){
 
+    int backend = optbackend==1 ? 1 : 0;
+    if(n_multistart>1)Opt_Hermite_MultiStart(n_multistart);
+    else Opt_Hermite_PredictNormal_UnitNormal(initnormals,newnormals,sol,optctx,n_threads,singleprecision>0,backend);
+    callfunc_time = optctx.acc_time;
+    solve_time = sol.time;
+
+    if(singleprecision==2){
+        Hermite_OptContext refctx;
+        Solution_Struct refsol;
+        vector<double>refnormals;
+        Opt_Hermite_PredictNormal_UnitNormal(initnormals,refnormals,refsol,refctx,n_threads,false,backend);
+        double maxangle = 0;
+        for(int i=0;i<npt;++i){
+            double cosang = MyUtility::dot(newnormals.data()+i*3,refnormals.data()+i*3);
+            maxangle = max(maxangle, acos(min(1.0,max(-1.0,cosang))));
+        }
+        cout<<setprecision(10);
+        cout<<"single precision check: energy "<<sol.energy<<" double "<<refsol.energy
+           <<" relative difference "<<fabs(sol.energy-refsol.energy)/fabs(refsol.energy)
+           <<" max normal angle (degree) "<<maxangle*180/my_PI<<endl;
+        cout<<"single precision check: time "<<sol.time<<" double "<<refsol.time<<endl;
+    }
 
-    sol.solveval.resize(npt * 2);
+    if(optbackend==2){
+        Hermite_OptContext sphctx;
+        Solution_Struct sphsol;
+        vector<double>sphnormals;
+        Opt_Hermite_PredictNormal_UnitNormal(initnormals,sphnormals,sphsol,sphctx,n_threads,singleprecision>0,1);
+        cout<<setprecision(10);
+        cout<<"backend\tevaluations\ttime\tenergy"<<endl;
+        cout<<"angles\t"<<optctx.countopt<<"\t"<<sol.time<<"\t"<<sol.energy<<endl;
+        cout<<"sphere\t"<<sphctx.countopt<<"\t"<<sphsol.time<<"\t"<<sphsol.energy<<endl;
+    }
 
+    arma::vec y(npt*4);
+    for(int i=0;i<npt;++i)y(i) = 0;
     for(int i=0;i<npt;++i){
-        double *veccc = initnormals.data()+i*3;
-        {
-            //MyUtility::normalize(veccc);
-            sol.solveval[i*2] = atan2(sqrt(veccc[0]*veccc[0]+veccc[1]*veccc[1]),veccc[2] );
-            sol.solveval[i*2 + 1] = atan2( veccc[1], veccc[0]   );
-        }
+        y(npt+i) = newnormals[i*3];
+        y(npt+i+npt) = newnormals[i*3+1];
+        y(npt+i+npt*2) = newnormals[i*3+2];
+    }
+
+    Set_RBFCoef(y);
+
+    //sol.energy = arma::dot(a,M*a);
+    cout<<"Opt_Hermite_PredictNormal_UnitNormal"<<endl;
+    return 1;
+}
+
+//the same energy on unit vectors, x holds the normals (x[i*3], x[i*3+1], x[i*3+2]), grad is the
+//Euclidean gradient 2Hx; used by Solver::sphereLBFGS
+double optfunc_Hermite_Sphere(const vector<double>&x, vector<double>&grad, void *fdata){
+
+    auto t1 = Clock::now();
+    Hermite_OptContext *ctx = reinterpret_cast<Hermite_OptContext*>(fdata);
+    int n = ctx->npt;
+    double *p_x = ctx->x3.data();
 
+    for(int i=0;i<n;++i){
+        p_x[i] = x[i*3];
+        p_x[i+n] = x[i*3+1];
+        p_x[i+n*2] = x[i*3+2];
     }
-    //cout<<"smallvec: "<<smallvec<<endl;
 
-    if(1){
+    ctx->H->symv(p_x, ctx->Hx.data(), ctx->n_threads, ctx->symv_work);
+    const double *p_a2 = ctx->Hx.data();
+
+    double re = 0;
+    grad.resize(n*3);
+    for(int i=0;i<n;++i){
+        double a0 = p_a2[i], a1 = p_a2[i+n], a2 = p_a2[i+n*2];
+        re += p_x[i]*a0 + p_x[i+n]*a1 + p_x[i+n*2]*a2;
+        grad[i*3] = 2*a0;
+        grad[i*3+1] = 2*a1;
+        grad[i*3+2] = 2*a2;
+    }
+
+    ctx->countopt++;
+    ctx->acc_time+=(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9);
+    return re;
+}
+
+//one run of the given backend with matrix H from init_normals, the counters of ctx are accumulated
+//0: nlopt L-BFGS on the spherical angles, 1: L-BFGS on the unit vectors (Solver::sphereLBFGS)
+void RBF_Core::Opt_Hermite_Backend(int backend, const SymMatrix *H, const vector<double> &init_normals, vector<double> &opt_normals, Solution_Struct &rsol, Hermite_OptContext &ctx, int n_symv_threads){
+
+    int countopt = ctx.countopt;
+    double acc_time = ctx.acc_time;
+    ctx.init(H,npt,n_symv_threads);
+
+    if(backend==1){
+        rsol.solveval = init_normals;
+        Solver::sphereLBFGS(optfunc_Hermite_Sphere,&ctx,1e-7,3000,rsol);
+        opt_normals = rsol.solveval;
+    }else{
+        rsol.solveval.resize(npt * 2);
+
+        for(int i=0;i<npt;++i){
+            const double *veccc = init_normals.data()+i*3;
+            {
+                //MyUtility::normalize(veccc);
+                rsol.solveval[i*2] = atan2(sqrt(veccc[0]*veccc[0]+veccc[1]*veccc[1]),veccc[2] );
+                rsol.solveval[i*2 + 1] = atan2( veccc[1], veccc[0]   );
+            }
+
+        }
+        //cout<<"smallvec: "<<smallvec<<endl;
+
         vector<double>upper(npt*2);
         vector<double>lower(npt*2);
         for(int i=0;i<npt;++i){
@@ -463,33 +727,161 @@ int RBF_Core::Opt_Hermite_PredictNormal_UnitNormal(){
             lower[i*2 + 1] = -2 * my_PI;
         }
 
-        countopt = 0;
-        acc_time = 0;
-
         //LocalIterativeSolver(sol,kk==0?normals:newnormals,300,1e-7);
-        Solver::nloptwrapper(lower,upper,optfunc_Hermite,this,1e-7,3000,sol);
-        cout<<"number of call: "<<countopt<<" t: "<<acc_time<<" ave: "<<acc_time/countopt<<endl;
-        callfunc_time = acc_time;
-        solve_time = sol.time;
-        //for(int i=0;i<npt;++i)cout<< sol.solveval[i]<<' ';cout<<endl;
+        Solver::nloptwrapper(lower,upper,optfunc_Hermite,&ctx,1e-7,3000,rsol);
+
+        opt_normals.resize(npt*3);
+        for(int i=0;i<npt;++i){
 
+            double a = rsol.solveval[i*2], b = rsol.solveval[i*2+1];
+            opt_normals[i*3]   = sin(a) * cos(b);
+            opt_normals[i*3+1] = sin(a) * sin(b);
+            opt_normals[i*3+2] = cos(a);
+        }
     }
-    newnormals.resize(npt*3);
-    arma::vec y(npt*4);
-    for(int i=0;i<npt;++i)y(i) = 0;
-    for(int i=0;i<npt;++i){
+    for(int i=0;i<npt;++i)MyUtility::normalize(opt_normals.data()+i*3);
+
+    ctx.countopt += countopt;
+    ctx.acc_time += acc_time;
+}
+
+//batched optfunc_Hermite_Sphere: the k points are gathered in one interleaved block and multiplied by
+//H with one SymMatrix::symm, which reads H once for all of them
+void optfunc_Hermite_SphereBatch(const vector<const vector<double>*>&xs, const vector<vector<double>*>&grads, vector<double>&fs, void *fdata){
 
-        double a = sol.solveval[i*2], b = sol.solveval[i*2+1];
-        newnormals[i*3]   = y(npt+i) = sin(a) * cos(b);
-        newnormals[i*3+1] = y(npt+i+npt) = sin(a) * sin(b);
-        newnormals[i*3+2] = y(npt+i+npt*2) = cos(a);
-        MyUtility::normalize(newnormals.data()+i*3);
+    auto t1 = Clock::now();
+    Hermite_OptContext *ctx = reinterpret_cast<Hermite_OptContext*>(fdata);
+    int n = ctx->npt, k = xs.size();
+    ctx->Xk.resize(size_t(n)*3*k);
+    ctx->HXk.resize(size_t(n)*3*k);
+    double *p_X = ctx->Xk.data();
+    const double *p_HX = ctx->HXk.data();
+
+    for(int r=0;r<k;++r){
+        const double *x = xs[r]->data();
+        for(int i=0;i<n;++i){
+            p_X[size_t(i)*k+r] = x[i*3];
+            p_X[size_t(i+n)*k+r] = x[i*3+1];
+            p_X[size_t(i+n*2)*k+r] = x[i*3+2];
+        }
     }
 
-    Set_RBFCoef(y);
+    ctx->H->symm(p_X, ctx->HXk.data(), k, ctx->n_threads, ctx->symv_work);
+
+    for(int r=0;r<k;++r){
+        vector<double>&grad = *grads[r];
+        grad.resize(n*3);
+        double re = 0;
+        for(int i=0;i<n;++i){
+            for(int j=0;j<3;++j){
+                size_t ind = size_t(i+j*n)*k+r;
+                re += p_X[ind]*p_HX[ind];
+                grad[i*3+j] = 2*p_HX[ind];
+            }
+        }
+        fs[r] = re;
+    }
+
+    ctx->countopt += k;
+    ctx->countbatch++;
+    ctx->acc_time+=(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9);
+}
+
+//optimize several sets of normals together with Solver::sphereLBFGSBatch; as Opt_Hermite_PredictNormal_UnitNormal
+//with isusesingle the run uses finalH_single and is polished with finalH
+void RBF_Core::Opt_Hermite_Batch(const vector<vector<double>> &init_normals, vector<vector<double>> &opt_normals, vector<Solution_Struct> &rsols, Hermite_OptContext &ctx, int n_symv_threads, bool isusesingle){
+
+    int k = init_normals.size();
+    rsols.resize(k);
+    opt_normals.resize(k);
+    for(int r=0;r<k;++r)rsols[r].solveval = init_normals[r];
+
+    bool issingle = isusesingle && !finalH_single.empty();
+    ctx.init(issingle ? &finalH_single : &finalH,npt,n_symv_threads);
+    Solver::sphereLBFGSBatch(optfunc_Hermite_SphereBatch,&ctx,1e-7,3000,rsols);
+    if(issingle){
+        vector<Solution_Struct>polish(k);
+        for(int r=0;r<k;++r)polish[r].solveval = rsols[r].solveval;
+        int countopt = ctx.countopt, countbatch = ctx.countbatch;
+        double acc_time = ctx.acc_time;
+        ctx.init(&finalH,npt,n_symv_threads);
+        Solver::sphereLBFGSBatch(optfunc_Hermite_SphereBatch,&ctx,1e-7,3000,polish);
+        cout<<"double polish: number of call: "<<ctx.countopt<<endl;
+        for(int r=0;r<k;++r){
+            polish[r].init_energy = rsols[r].init_energy;
+            polish[r].time += rsols[r].time;
+        }
+        rsols.swap(polish);
+        ctx.countopt += countopt;
+        ctx.countbatch += countbatch;
+        ctx.acc_time += acc_time;
+    }
+    for(int r=0;r<k;++r){
+        opt_normals[r] = rsols[r].solveval;
+        for(int i=0;i<npt;++i)MyUtility::normalize(opt_normals[r].data()+i*3);
+    }
+    cout<<"batch of "<<k<<": number of call: "<<ctx.countopt<<" passes over H: "<<ctx.countbatch<<" t: "<<ctx.acc_time<<endl;
+}
+
+//n_start sets of normals optimized in one batch: initnormals, the previous result if there is one, and
+//random perturbations of initnormals (deterministic); the lowest energy is kept
+void RBF_Core::Opt_Hermite_MultiStart(int n_start){
+
+    vector<vector<double>>starts(1,initnormals);
+    if(newnormals.size()==initnormals.size())starts.push_back(newnormals);
+    for(int r=starts.size();r<n_start;++r){
+        std::mt19937 gen(r);
+        std::uniform_real_distribution<double>noise(-0.5,0.5);
+        vector<double>start = initnormals;
+        for(int i=0;i<npt;++i){
+            double *p_n = start.data()+i*3;
+            MyUtility::normalize(p_n);
+            for(int j=0;j<3;++j)p_n[j] += noise(gen);
+            MyUtility::normalize(p_n);
+        }
+        starts.push_back(start);
+    }
+
+    vector<vector<double>>opts;
+    vector<Solution_Struct>sols;
+    Opt_Hermite_Batch(starts,opts,sols,optctx,n_threads,singleprecision>0);
+
+    cout<<std::setprecision(8);
+    int minind = 0;
+    for(int r=0;r<int(sols.size());++r){
+        cout<<"start "<<r<<": "<<sols[r].init_energy<<" -> "<<sols[r].energy<<endl;
+        if(sols[r].energy<sols[minind].energy)minind = r;
+    }
+    cout<<"multi-start: best start "<<minind<<endl;
+    newnormals = opts[minind];
+    sol = sols[minind];
+}
+
+//optimize the normals on the unit sphere starting from init_normals, the energy is given by finalH;
+//all the state of the run lives in rsol and ctx, so several runs can share one RBF_Core.
+//with isusesingle the run uses finalH_single and is polished with finalH from where it stopped
+int RBF_Core::Opt_Hermite_PredictNormal_UnitNormal(const vector<double> &init_normals, vector<double> &opt_normals, Solution_Struct &rsol, Hermite_OptContext &ctx, int n_symv_threads, bool isusesingle, int backend){
+
+    ctx.countopt = 0;
+    ctx.acc_time = 0;
+    if(isusesingle && !finalH_single.empty()){
+        Opt_Hermite_Backend(backend,&finalH_single,init_normals,opt_normals,rsol,ctx,n_symv_threads);
+        cout<<"single precision: number of call: "<<ctx.countopt<<" t: "<<ctx.acc_time<<" energy: "<<rsol.energy<<endl;
+
+        int single_count = ctx.countopt;
+        Solution_Struct polish;
+        vector<double>single_normals = opt_normals;
+        Opt_Hermite_Backend(backend,&finalH,single_normals,opt_normals,polish,ctx,n_symv_threads);
+        cout<<"double polish: number of call: "<<ctx.countopt-single_count<<" energy: "<<polish.energy<<endl;
+
+        polish.init_energy = rsol.init_energy;
+        polish.time += rsol.time;
+        rsol = polish;
+    }else{
+        Opt_Hermite_Backend(backend,&finalH,init_normals,opt_normals,rsol,ctx,n_symv_threads);
+    }
+    cout<<"number of call: "<<ctx.countopt<<" t: "<<ctx.acc_time<<" ave: "<<ctx.acc_time/ctx.countopt<<endl;
 
-    //sol.energy = arma::dot(a,M*a);
-    cout<<"Opt_Hermite_PredictNormal_UnitNormal"<<endl;
     return 1;
 }
 
@@ -504,13 +896,34 @@ void RBF_Core::Set_RBFCoef(arma::vec &y){
         a = Minv * (y - N*b);
     }else{
 
-        if(User_Lamnbda>0)y.subvec(0,npt-1) = -User_Lamnbda*dI*K01*y.subvec(npt,npt*4-1);
+        if(User_Lamnbda>0){
+            //-lamnbda*(I + lamnbda*K00)^-1*K01*y1 with the cached spectral decomposition of K00
+            Set_K00_Spectral();
+            if(isK00_spectral){
+                arma::vec Wy = K00_W*y.subvec(npt,npt*4-1);
+                for(int i=0;i<npt;++i)Wy(i) *= User_Lamnbda / (1 + User_Lamnbda*K00_d(i));
+                y.subvec(0,npt-1) = -K00_V*Wy;
+            }else{
+                arma::mat eye;
+                eye.eye(npt,npt);
+                y.subvec(0,npt-1) = -User_Lamnbda*solve(eye + User_Lamnbda*K00, K01*y.subvec(npt,npt*4-1));
+            }
+        }
 
-        a = Minv*y;
-        b = Ninv.t()*y;
+        if(isuse_nullspace){
+            //a = [K00 K01; K01' K11] y, and N b = y - M a solved in the least squares sense
+            a.set_size(npt*4);
+            a.subvec(0,npt-1) = K00*y.subvec(0,npt-1) + K01*y.subvec(npt,npt*4-1);
+            a.subvec(npt,npt*4-1) = K01.t()*y.subvec(0,npt-1) + K11*y.subvec(npt,npt*4-1);
+            b = solve(NtN, N.t()*y - MN.t()*a);
+        }else{
+            a = Minv*y;
+            b = Ninv.t()*y;
+        }
 
     }
 
+    evaluator.Set(*this);
 
 }
 
@@ -523,38 +936,64 @@ int RBF_Core::Lamnbda_Search_GlobalEigen(){
     //lamnbda_list.clear();
     //for(double i=1.5;i<2.5;i+=0.1)lamnbda_list.push_back(i);
     //vector<double>lamnbda_list({0});
-    vector<double>initen_list(lamnbda_list.size());
-    vector<double>finalen_list(lamnbda_list.size());
-    vector<vector<double>>init_normallist;
-    vector<vector<double>>opt_normallist;
+    int n_cand = lamnbda_list.size();
+    vector<double>initen_list(n_cand);
+    vector<double>finalen_list(n_cand);
+    vector<vector<double>>init_normallist(n_cand);
+    vector<vector<double>>opt_normallist(n_cand);
+    vector<Solution_Struct>sol_list(n_cand);
+    vector<Hermite_OptContext>optctx_list(n_cand);
 
     lamnbda_list_sa = lamnbda_list;
-    for(int i=0;i<lamnbda_list.size();++i){
-
-        Set_HermiteApprox_Lamnda(lamnbda_list[i]);
 
-        if(curMethod==Hermite_UnitNormal){
-            Solve_Hermite_PredictNormal_UnitNorm();
-        }
+    //the candidates only read K00, K01, K11 and finalH, n_task of them run at the same time
+    //and the threads left are given to BLAS and to the finalH products
+    int n_task = n_search_threads > 0 ? n_search_threads : n_threads;
+    n_task = max(1, min(n_task, n_cand));
+    int n_blas = max(1, n_threads / n_task);
+    bool isblasset = Solver::setBLASThreads(n_blas);
+    cout<<"lamnbda search: "<<n_task<<" concurrent candidates, "<<n_blas<<" BLAS threads each";
+    if(!isblasset)cout<<" (BLAS threads not adjustable, using the library default)";
+    cout<<endl;
 
-        //Solve_Hermite_PredictNormal_UnitNorm();
-        OptNormal(1);
+    if(curMethod==Hermite_UnitNormal && *max_element(lamnbda_list.begin(),lamnbda_list.end())>0)Set_K00_Spectral();
 
-        initen_list[i] = sol.init_energy;
-        finalen_list[i] = sol.energy;
+    auto t1 = Clock::now();
+    auto search_candidate = [&](int i, int){
 
-        init_normallist.emplace_back(initnormals);
-        opt_normallist.emplace_back(newnormals);
+        if(curMethod==Hermite_UnitNormal){
+            arma::mat Kbuf;
+            Get_HermiteApprox_K(lamnbda_list[i],Kbuf);
+            Solve_Hermite_PredictNormal_UnitNorm(Kbuf,init_normallist[i]);
+        }else init_normallist[i] = initnormals;
+
+        if(n_multistart>1)return;
+        Opt_Hermite_PredictNormal_UnitNormal(init_normallist[i],opt_normallist[i],sol_list[i],optctx_list[i],n_blas,singleprecision>0,optbackend==1 ? 1 : 0);
+    };
+    MyUtility::parallelFor(n_cand, n_task, search_candidate);
+    if(isblasset)Solver::setBLASThreads(n_threads);
+
+    //batched: all the candidates are optimized together on finalH, one pass over it per round
+    if(n_multistart>1){
+        Opt_Hermite_Batch(init_normallist,opt_normallist,sol_list,optctx_list[0],n_threads,singleprecision>0);
+    }
+    for(int i=0;i<n_cand;++i){
+        initen_list[i] = sol_list[i].init_energy;
+        finalen_list[i] = sol_list[i].energy;
     }
+    cout<<"lamnbda search time: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
 
     lamnbdaGlobal_Be.emplace_back(initen_list);
     lamnbdaGlobal_Ed.emplace_back(finalen_list);
 
     cout<<std::setprecision(8);
     for(int i=0;i<initen_list.size();++i){
-        cout<<lamnbda_list[i]<<": "<<initen_list[i]<<" -> "<<finalen_list[i]<<endl;
+        cout<<lamnbda_list[i]<<": "<<initen_list[i]<<" -> "<<finalen_list[i];
+        if(n_multistart<=1)cout<<"  ("<<optctx_list[i].countopt<<" calls)";
+        cout<<endl;
     }
 
+    //first minimum wins, independent of the order in which the candidates finished
     int minind = min_element(finalen_list.begin(),finalen_list.end()) - finalen_list.begin();
     cout<<"min energy: "<<endl;
     cout<<lamnbda_list[minind]<<": "<<initen_list[minind]<<" -> "<<finalen_list[minind]<<endl;
@@ -563,6 +1002,7 @@ int RBF_Core::Lamnbda_Search_GlobalEigen(){
     initnormals = init_normallist[minind];
     SetInitnormal_Uninorm();
     newnormals = opt_normallist[minind];
+    sol = sol_list[minind];
 	return 1;
 }
 
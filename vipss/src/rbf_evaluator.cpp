@@ -0,0 +1,189 @@
+#include "rbf_evaluator.h"
+#include "rbfcore.h"
+#include "utility.h"
+#include <cmath>
+
+
+RBF_Evaluator::RBF_Evaluator(const RBF_Evaluator &other){
+    *this = other;
+}
+
+RBF_Evaluator &RBF_Evaluator::operator=(const RBF_Evaluator &other){
+
+    npt = other.npt;
+    polyDeg = other.polyDeg;
+    isHermite = other.isHermite;
+    kernal = other.kernal;
+    sigma = other.sigma;
+    cx = other.cx;
+    cy = other.cy;
+    cz = other.cz;
+    w = other.w;
+    ux = other.ux;
+    uy = other.uy;
+    uz = other.uz;
+    a = other.a;
+    b = other.b;
+    n_evacalls.store(other.Evaluations(), memory_order_relaxed);
+    return *this;
+}
+
+void RBF_Evaluator::Set(const RBF_Core &rbf){
+
+    npt = rbf.npt;
+    polyDeg = rbf.polyDeg;
+    isHermite = rbf.isHermite;
+    kernal = rbf.kernal;
+    sigma = rbf.kernal_sigma;
+    a.assign(rbf.a.memptr(),rbf.a.memptr()+rbf.a.n_elem);
+    b.assign(rbf.b.memptr(),rbf.b.memptr()+rbf.b.n_elem);
+
+    int npad = XCubeSIMD::padded(npt);
+    for(auto v:{&cx,&cy,&cz,&w,&ux,&uy,&uz})v->assign(npad,0);
+    for(int i=0;i<npt;++i){
+        cx[i] = rbf.pts[i*3];
+        cy[i] = rbf.pts[i*3+1];
+        cz[i] = rbf.pts[i*3+2];
+        w[i] = a[i];
+        if(isHermite){
+            ux[i] = a[npt+i];
+            uy[i] = a[npt*2+i];
+            uz[i] = a[npt*3+i];
+        }
+    }
+    ResetEvaluations();
+}
+
+//f(p) = sum_i a_i k(p_i,p) + sum_i <a'_i, grad k(p,p_i)> + poly(p), accumulated in place instead of
+//through a kernel vector, so no buffer is needed
+template <class Kernel>
+double RBF_Evaluator::Evaluate_Sum(const Kernel &ker, const double *p) const{
+
+    return Kernel_Contract(ker,p,cx.data(),cy.data(),cz.data(),w.data(),ux.data(),uy.data(),uz.data(),int(cx.size())) + Evaluate_Poly(p);
+}
+
+double RBF_Evaluator::Evaluate_Sum(const double *p) const{
+
+    switch(kernal){
+    case ThinSpline: return Evaluate_Sum(ThinSpline_Policy(),p);
+    case Gaussian: return Evaluate_Sum(Gaussian_Policy(sigma),p);
+    default: return Evaluate_Sum(XCube_Policy(),p);
+    }
+}
+
+double RBF_Evaluator::Evaluate_Poly(const double *p) const{
+
+    double poly_part = 0;
+    if(polyDeg==1){
+        poly_part = b[0] + b[1]*p[0] + b[2]*p[1] + b[3]*p[2];
+    }else if(polyDeg==2){
+        double buf[4] = {1, p[0], p[1], p[2]};
+        int ind = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k)poly_part += b[ind++] * buf[j] * buf[k];
+    }
+    return poly_part;
+}
+
+//value and gradient of the polynomial part, the gradient is added to grad
+double RBF_Evaluator::Evaluate_Poly(const double *p, double *grad) const{
+
+    double poly_part = 0;
+    if(polyDeg==1){
+        poly_part = b[0] + b[1]*p[0] + b[2]*p[1] + b[3]*p[2];
+        for(int i=0;i<3;++i)grad[i] += b[i+1];
+    }else if(polyDeg==2){
+        double buf[4] = {1, p[0], p[1], p[2]};
+        int ind = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k){
+            double bb = b[ind++];
+            poly_part += bb * buf[j] * buf[k];
+            if(j>0)grad[j-1] += bb * buf[k];
+            if(k>0)grad[k-1] += bb * buf[j];
+        }
+    }
+    return poly_part;
+}
+
+template <class Kernel>
+double RBF_Evaluator::Evaluate_Gradient(const Kernel &ker, const double *p, double *grad) const{
+
+    grad[0] = grad[1] = grad[2] = 0;
+    double loc_part = Kernel_ContractGradient(ker,p,cx.data(),cy.data(),cz.data(),w.data(),ux.data(),uy.data(),uz.data(),int(cx.size()),grad);
+    return loc_part + Evaluate_Poly(p,grad);
+}
+
+double RBF_Evaluator::Evaluate_Gradient(const double *p, double *grad) const{
+
+    switch(kernal){
+    case ThinSpline: return Evaluate_Gradient(ThinSpline_Policy(),p,grad);
+    case Gaussian: return Evaluate_Gradient(Gaussian_Policy(sigma),p,grad);
+    default: return Evaluate_Gradient(XCube_Policy(),p,grad);
+    }
+}
+
+//the coordinates of the block stay in L1 while the centers stream through once
+template <class Kernel>
+void RBF_Evaluator::Evaluate_Block(const Kernel &ker, const double *p, int m, double *out) const{
+
+    double qx[QueryBlock], qy[QueryBlock], qz[QueryBlock], acc[QueryBlock];
+    for(int j=0;j<QueryBlock;++j){
+        int jj = j<m ? j : m-1;
+        qx[j] = p[jj*3];
+        qy[j] = p[jj*3+1];
+        qz[j] = p[jj*3+2];
+        acc[j] = 0;
+    }
+    Kernel_ContractBlock(ker,qx,qy,qz,QueryBlock,cx.data(),cy.data(),cz.data(),w.data(),ux.data(),uy.data(),uz.data(),npt,acc);
+
+    for(int j=0;j<m;++j)out[j] = acc[j] + Evaluate_Poly(p+j*3);
+}
+
+void RBF_Evaluator::Evaluate_Block(const double *p, int m, double *out) const{
+
+    switch(kernal){
+    case ThinSpline: Evaluate_Block(ThinSpline_Policy(),p,m,out); break;
+    case Gaussian: Evaluate_Block(Gaussian_Policy(sigma),p,m,out); break;
+    default: Evaluate_Block(XCube_Policy(),p,m,out); break;
+    }
+}
+
+void RBF_Evaluator::Evaluate(const double *p, size_t m, double *out, int n_threads) const{
+
+    if(m==0)return;
+    n_evacalls.fetch_add(m, memory_order_relaxed);
+    int n_blocks = (m + QueryBlock - 1) / QueryBlock;
+    MyUtility::parallelFor(n_blocks, n_threads, [&](int t, int){
+        size_t j0 = size_t(t) * QueryBlock;
+        int mb = int(min(m - j0, size_t(QueryBlock)));
+        Evaluate_Block(p+j0*3, mb, out+j0);
+    });
+}
+
+double RBF_Evaluator::Evaluate(const double *p, Scratch &scratch) const{
+
+    ++scratch.n_evals;
+    return Evaluate_Sum(p);
+}
+
+double RBF_Evaluator::Evaluate(const double *p) const{
+
+    n_evacalls.fetch_add(1, memory_order_relaxed);
+    return Evaluate_Sum(p);
+}
+
+double RBF_Evaluator::EvaluateGradient(const double *p, double *grad, Scratch &scratch) const{
+
+    ++scratch.n_evals;
+    return Evaluate_Gradient(p,grad);
+}
+
+double RBF_Evaluator::EvaluateGradient(const double *p, double *grad) const{
+
+    n_evacalls.fetch_add(1, memory_order_relaxed);
+    return Evaluate_Gradient(p,grad);
+}
+
+void RBF_Evaluator::AddEvaluations(const Scratch &scratch) const{
+
+    n_evacalls.fetch_add(scratch.n_evals, memory_order_relaxed);
+}
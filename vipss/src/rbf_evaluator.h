@@ -0,0 +1,80 @@
+#ifndef RBF_EVALUATOR_H
+#define RBF_EVALUATOR_H
+
+
+#include <vector>
+#include <atomic>
+#include "rbf_kernels.h"
+using namespace std;
+
+class RBF_Core;
+
+//read-only copy of a solved RBF (centers, coefficients a and b, kernel), evaluated without any
+//shared mutable state: every thread passes its own Scratch, so many threads and many models can
+//evaluate at the same time. Counts of Scratch are merged into the total with AddEvaluations;
+//Evaluate(p) without a Scratch counts directly into the (atomic) total
+class RBF_Evaluator{
+
+public:
+    class Scratch{
+    public:
+        long long n_evals = 0;
+    };
+
+public:
+    int npt = 0;
+    int polyDeg = 1;
+    bool isHermite = false;
+    RBF_Kernal kernal = XCube;
+    double sigma = 1;
+    vector<double>a;
+    vector<double>b;
+
+    //centers split by coordinate and the weights a_i, a'_i, all padded with zeros to a multiple of
+    //XCubeSIMD::Width, for the kernel loops of rbf_kernels.h
+    vector<double>cx, cy, cz;
+    vector<double>w, ux, uy, uz;
+
+public:
+    RBF_Evaluator(){}
+    RBF_Evaluator(const RBF_Core &rbf){Set(rbf);}
+    RBF_Evaluator(const RBF_Evaluator &other);
+    RBF_Evaluator &operator=(const RBF_Evaluator &other);
+
+    void Set(const RBF_Core &rbf);
+    bool empty() const {return npt==0;}
+
+    double Evaluate(const double *p, Scratch &scratch) const;
+    double Evaluate(const double *p) const;
+
+    //f(p), and its gradient in grad, in closed form
+    double EvaluateGradient(const double *p, double *grad, Scratch &scratch) const;
+    double EvaluateGradient(const double *p, double *grad) const;
+
+    //out[j] = f(p_j) for the m points p (3*m coordinates). Points are taken in blocks of
+    //QueryBlock that are swept against all centers at once (each center is broadcast against the
+    //block by Kernel_ContractBlock), the blocks are shared by n_threads threads
+    void Evaluate(const double *p, size_t m, double *out, int n_threads = 1) const;
+
+    static const int QueryBlock = 64;
+
+    void AddEvaluations(const Scratch &scratch) const;
+    long long Evaluations() const {return n_evacalls.load(memory_order_relaxed);}
+    void ResetEvaluations() const {n_evacalls.store(0, memory_order_relaxed);}
+
+private:
+    double Evaluate_Sum(const double *p) const;
+    template <class Kernel> double Evaluate_Sum(const Kernel &ker, const double *p) const;
+    double Evaluate_Gradient(const double *p, double *grad) const;
+    template <class Kernel> double Evaluate_Gradient(const Kernel &ker, const double *p, double *grad) const;
+    double Evaluate_Poly(const double *p, double *grad) const;
+    double Evaluate_Poly(const double *p) const;
+    void Evaluate_Block(const double *p, int m, double *out) const;
+    template <class Kernel> void Evaluate_Block(const Kernel &ker, const double *p, int m, double *out) const;
+
+    mutable atomic<long long> n_evacalls{0};
+};
+
+
+
+#endif // RBF_EVALUATOR_H
@@ -15,6 +15,7 @@ void RBF_Core::BuildK(RBF_Paras para){
 
     isuse_sparse = para.isusesparse;
     sparse_para = para.sparse_para;
+    isuse_nullspace = para.isusenullspace;
     Hermite_weight_smoothness = para.Hermite_weight_smoothness;
     Hermite_designcurve_weight = para.Hermite_designcurve_weight;
 //    handcraft_sigma = para.handcraft_sigma;
@@ -85,21 +86,161 @@ void RBF_Core::OptNormal(int method){
 }
 
 
-void RBF_Core::Surfacing(int method, int n_voxels_1d){
+double RBF_Core::SurfacingPass(Surfacer &sf, int n_voxels_1d){
+
+    double re_time;
+    evaluator.ResetEvaluations();
+    sf.p_previewproc = RBF_Core::Surfacing_Preview;
+    double (*function)(const R3Pt &) = RBF_Core::Dist_Function;
+    double (*gradient)(const R3Pt &, R3Vec &) = RBF_Core::Dist_Function_Gradient;
+    void (*batch)(const double *, int, double *) = RBF_Core::Dist_Function_Batch;
+    //the cached gradients are interpolated for free, and the finite differences of the trilinear values
+    //would facet the normals, so the tracker takes them also without -g
+    bool isgradient = isanalyticgrad || !sdfcache.empty();
+    if(!sdfcache.empty()){
+        function = RBF_Core::Dist_Function_Cached;
+        gradient = RBF_Core::Dist_Function_Gradient_Cached;
+        batch = RBF_Core::Dist_Function_Batch_Cached;
+    }
+    if(octree_tol>0 || surf_previews>0)re_time = sf.Surfacing_Octree(pts,n_voxels_1d,octree_tol,batch,
+                                                                     gradient, n_threads, surf_previews);
+    else if(isgridsurfacing)re_time = sf.Surfacing_Grid(pts,n_voxels_1d,function,batch,
+                                                     isgradient ? gradient : NULL, n_threads);
+    else re_time = sf.Surfacing_Implicit(pts,n_voxels_1d,false,function,
+                                         isgradient ? gradient : NULL, n_threads);
+    n_evacalls = evaluator.Evaluations();
+    return re_time;
+}
+
+void RBF_Core::PrepareSDFCache(int n_voxels_1d){
+
+    if(surf_cachename.empty())return;
+    if(sdfcache.empty() && !sdfcache.Load(surf_cachename, evaluator) && n_voxels_1d<=0)return;
+    if(n_voxels_1d<=0)return;
+
+    //the lattice points are the grid corners of the surfacing, center + (i-.5)*size
+    Surfacer sf;
+    sf.CalSurfacingPara(pts, n_voxels_1d);
+    double origin[3];
+    for(int i=0;i<3;++i)origin[i] = sf.st[i] - 0.5*sf.dSize;
+    if(!sdfcache.empty()){
+        if(sdfcache.Covers(origin, sf.dSize))return;
+        cout<<"SDF cache "<<surf_cachename<<": spacing "<<sdfcache.spacing<<" does not cover the grid of "
+           <<n_voxels_1d<<" voxels (size "<<sf.dSize<<"), rebuilt on it"<<endl;
+    }else cout<<"SDF cache "<<surf_cachename<<": new, spacing "<<sf.dSize<<endl;
+    sdfcache.Reset(evaluator, origin, sf.dSize);
+}
+
+void RBF_Core::SaveSDFCache(){
+
+    if(sdfcache.empty() || sdfcache.NewBricks()==0)return;
+    size_t n_new = sdfcache.NewBricks();
+    if(sdfcache.Save(surf_cachename))
+        cout<<"SDF cache "<<surf_cachename<<" saved: "<<sdfcache.Bricks()<<" bricks ("<<n_new<<" new)"<<endl;
+}
+
+static const int SURF_CALIBRATION = 32;   //voxels per line of the calibration pass
+static const double SURF_SAFETY = 0.8;    //part of the remaining budget planned for
+
+void RBF_Core::Surfacing_Budget(int n_voxels_1d, string streamfname){
+
+    auto t1 = Clock::now();
+    int n_cal = min(n_voxels_1d, SURF_CALIBRATION);
+    surf_deadline = 0;
+    surf_evallimit = 0;
 
-    n_evacalls = 0;
+    PrepareSDFCache(0);
     Surfacer sf;
+    double t_cal = SurfacingPass(sf, n_cal);
+    long long e_cal = n_evacalls;
+    sf.MoveSurface(finalMesh_v,finalMesh_fv,finalMesh_vn);
+
+    //the work grows with the surface area in voxels, n^2 (the whole grid of -a, n^3)
+    double power = (octree_tol<=0 && surf_previews<=0 && isgridsurfacing) ? 3 : 2;
+    double scale = numeric_limits<double>::max();
+    if(surf_evalbudget>0)scale = min(scale, SURF_SAFETY*(surf_evalbudget-e_cal)/max(e_cal,1LL));
+    if(surf_timebudget>0)scale = min(scale, SURF_SAFETY*(surf_timebudget-t_cal)/max(t_cal,1e-6));
+    int n_voxels = scale>1 ? min((double)n_voxels_1d, floor(n_cal*pow(scale, 1./power))) : n_cal;
+
+    cout<<"Surfacing budget: calibration at "<<n_cal<<" voxels, "<<e_cal<<" evaluations in "<<t_cal<<" s ("
+       <<e_cal/max(t_cal,1e-6)<<" per second), chosen: "<<n_voxels<<" voxels"<<endl;
+
+    PLYStreamWriter stream;
+    bool iscompleted = false;
+    if(n_voxels>n_cal){
+        Surfacer sf_final;
+        sf_final.p_continue = RBF_Core::Surfacing_Continue;
+        if(surf_evalbudget>0)surf_evallimit = max(surf_evalbudget-e_cal, 1LL);
+        double t_used = std::chrono::nanoseconds(Clock::now() - t1).count()/1e9;
+        if(surf_timebudget>0)surf_deadline = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count()+surf_timebudget-t_used;
+        if(!streamfname.empty() && stream.Open(streamfname))sf_final.p_stream = &stream;
+
+        PrepareSDFCache(n_voxels);
+        SurfacingPass(sf_final, n_voxels);
+        n_evacalls += e_cal;
+        surf_deadline = 0;
+        surf_evallimit = 0;
+        iscompleted = !sf_final.isaborted;
+        if(iscompleted)sf_final.MoveSurface(finalMesh_v,finalMesh_fv,finalMesh_vn);
+        else cout<<"Surfacing at "<<n_voxels<<" voxels exceeded the budget, keeping the mesh at "<<n_cal<<" voxels"<<endl;
+    }
+
+    //the calibration mesh, if it is the result, to the stream:
+    if(!streamfname.empty() && !iscompleted && stream.Open(streamfname)){
+        for(size_t i=0;i<finalMesh_v.size()/3;++i)stream.AddVertex(finalMesh_v.data()+3*i, finalMesh_vn.data()+3*i);
+        for(size_t i=0;i<finalMesh_fv.size()/3;++i)stream.AddFace(finalMesh_fv[3*i],finalMesh_fv[3*i+1],finalMesh_fv[3*i+2]);
+    }
+    stream.Close();
+    SaveSDFCache();
 
-    surf_time = sf.Surfacing_Implicit(pts,n_voxels_1d,false,RBF_Core::Dist_Function);
+    surf_time = std::chrono::nanoseconds(Clock::now() - t1).count()/1e9;
+    cout<<"Budget surfacing time: "<<surf_time<<"   n_evacalls: "<<n_evacalls<<endl;
+}
+
+void RBF_Core::Surfacing(int method, int n_voxels_1d, string streamfname){
+
+    if(surf_timebudget>0 || surf_evalbudget>0){
+        Surfacing_Budget(n_voxels_1d, streamfname);
+        return;
+    }
 
-    sf.WriteSurface(finalMesh_v,finalMesh_fv);
+    Surfacer sf;
+    PLYStreamWriter stream;
+    if(!streamfname.empty() && stream.Open(streamfname))sf.p_stream = &stream;
+
+    PrepareSDFCache(n_voxels_1d);
+    surf_time = SurfacingPass(sf, n_voxels_1d);
+    SaveSDFCache();
+
+    sf.MoveSurface(finalMesh_v,finalMesh_fv,finalMesh_vn);
+    long long n_vertices = finalMesh_v.size()/3;
+    if(sf.p_stream){
+        n_vertices = stream.n_vertices;
+        stream.Close();
+    }
 
     cout<<"n_evacalls: "<<n_evacalls<<"   ave: "<<surf_time/n_evacalls<<endl;
+    if(n_vertices)cout<<"evaluations per vertex: "<<double(n_evacalls)/n_vertices<<(isanalyticgrad ? " (analytic gradient)" : "")<<endl;
 
 
 }
 
 
+void RBF_Core::Evaluate_Points(const vector<double> &query, vector<double> &values){
+
+    size_t m = query.size()/3;
+    values.resize(m);
+    auto t1 = Clock::now();
+    //from the cached bricks where there are some, no brick is added for scattered points
+    PrepareSDFCache(0);
+    if(!sdfcache.empty())sdfcache.Evaluate(query.data(), m, values.data(), n_threads, false);
+    else evaluator.Evaluate(query.data(), m, values.data(), n_threads);
+    double t = std::chrono::nanoseconds(Clock::now() - t1).count()/1e9;
+    cout<<"evaluate "<<m<<" points ("<<n_threads<<" threads): "<<t<<"   points/s: "<<(t>0 ? m/t : 0)<<endl;
+}
+
+
 int RBF_Core::InjectData(vector<double> &pts, RBF_Paras para){
 
     vector<int> labels;
@@ -125,6 +266,17 @@ int RBF_Core::InjectData(vector<double> &pts, vector<int> &labels, vector<double
     curInitMethod = para.InitMethod;
 
     polyDeg = para.polyDeg;
+    n_threads = para.n_threads > 0 ? para.n_threads : MyUtility::hardwareThreads();
+    n_search_threads = para.n_search_threads;
+    singleprecision = para.singleprecision;
+    optbackend = para.optbackend;
+    n_multistart = para.n_multistart;
+    isanalyticgrad = para.isanalyticgrad;
+    isgridsurfacing = para.isgridsurfacing;
+    octree_tol = para.octree_tol;
+    surf_timebudget = para.surf_timebudget;
+    surf_evalbudget = para.surf_evalbudget;
+    surf_previews = para.surf_previews;
     User_Lamnbda = para.user_lamnbda;
     rangevalue = para.rangevalue;
     maxvalue = 10000;
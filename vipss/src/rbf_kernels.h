@@ -0,0 +1,159 @@
+#ifndef RBF_KERNELS_H
+#define RBF_KERNELS_H
+
+
+#include <cmath>
+#include "xcube_simd.h"
+
+
+enum RBF_Kernal{
+    XCube,
+    ThinSpline,
+    XLinear,
+    Gaussian,
+};
+
+
+//radial kernel policies. For d = p - c, r = |d| and the kernel phi(r), radial(d2, k, g, h) gives
+//k = phi, g = phi'/r and h = (phi'' - phi'/r)/r^2, so that grad phi = g d and
+//hess phi = h d d^T + g I. They are plain inline functions, so the loops below are instantiated
+//and inlined for every kernel, with one switch on RBF_Kernal at the top. XLinear is not
+//implemented and is treated as XCube
+
+class XCube_Policy{
+public:
+    inline void radial(double d2, double &k, double &g, double &h) const{
+        double r = sqrt(d2);
+        k = d2*r;
+        g = 3*r;
+        h = r<1e-8 ? 0 : 3/r;
+    }
+};
+
+//r^2 log r, the gradient and hessian are set to 0 at r = 0 where they are singular
+class ThinSpline_Policy{
+public:
+    inline void radial(double d2, double &k, double &g, double &h) const{
+        if(d2<1e-16){
+            k = g = h = 0;
+            return;
+        }
+        double lr = 0.5*log(d2);
+        k = d2*lr;
+        g = 2*lr + 1;
+        h = 2/d2;
+    }
+};
+
+//exp(-r^2 / (2 sigma^2))
+class Gaussian_Policy{
+public:
+    double inv_sigma2;
+    Gaussian_Policy(double sigma):inv_sigma2(1/(sigma*sigma)){}
+    inline void radial(double d2, double &k, double &g, double &h) const{
+        k = exp(-0.5*d2*inv_sigma2);
+        g = -k*inv_sigma2;
+        h = k*inv_sigma2*inv_sigma2;
+    }
+};
+
+
+/*************************************************************/
+//kernel loops in the layouts of xcube_simd.h; the XCube instantiations are the SIMD kernels
+
+//K[i] = phi, G[i+k*n] = grad phi (in p), H[i+k*n] = hess phi for k = xx, xy, xz, yy, yz, zz
+template <class Kernel>
+inline void Kernel_ValueGradHessian(const Kernel &ker, const double *p, const double *cx, const double *cy, const double *cz, int n,
+                                    double *K, double *G, double *H){
+    for(int i=0;i<n;++i){
+        double dx = p[0]-cx[i], dy = p[1]-cy[i], dz = p[2]-cz[i];
+        double k, g, h;
+        ker.radial(dx*dx + dy*dy + dz*dz, k, g, h);
+        K[i] = k;
+        G[i] = g*dx; G[i+n] = g*dy; G[i+n*2] = g*dz;
+        double hx = h*dx, hy = h*dy, hz = h*dz;
+        H[i] = hx*dx + g; H[i+n] = hx*dy; H[i+n*2] = hx*dz;
+        H[i+n*3] = hy*dy + g; H[i+n*4] = hy*dz; H[i+n*5] = hz*dz + g;
+    }
+}
+
+template <>
+inline void Kernel_ValueGradHessian<XCube_Policy>(const XCube_Policy &, const double *p, const double *cx, const double *cy, const double *cz, int n,
+                                                  double *K, double *G, double *H){
+    XCubeSIMD::valueGradHessian(p,cx,cy,cz,n,K,G,H);
+}
+
+//sum_i w_i phi + <u_i, grad phi>, n a multiple of XCubeSIMD::Width (arrays padded with zeros)
+template <class Kernel>
+inline double Kernel_Contract(const Kernel &ker, const double *p, const double *cx, const double *cy, const double *cz,
+                              const double *w, const double *ux, const double *uy, const double *uz, int n){
+    double acc = 0;
+    for(int i=0;i<n;++i){
+        double dx = p[0]-cx[i], dy = p[1]-cy[i], dz = p[2]-cz[i];
+        double k, g, h;
+        ker.radial(dx*dx + dy*dy + dz*dz, k, g, h);
+        acc += w[i]*k + g*(ux[i]*dx + uy[i]*dy + uz[i]*dz);
+    }
+    return acc;
+}
+
+template <>
+inline double Kernel_Contract<XCube_Policy>(const XCube_Policy &, const double *p, const double *cx, const double *cy, const double *cz,
+                                            const double *w, const double *ux, const double *uy, const double *uz, int n){
+    return XCubeSIMD::contract(p,cx,cy,cz,w,ux,uy,uz,n);
+}
+
+//Kernel_Contract and its gradient in p, sum_i w_i grad phi + hess phi u_i, added to grad (n as for
+//Kernel_Contract)
+template <class Kernel>
+inline double Kernel_ContractGradient(const Kernel &ker, const double *p, const double *cx, const double *cy, const double *cz,
+                                      const double *w, const double *ux, const double *uy, const double *uz, int n, double *grad){
+    double acc = 0, gx = 0, gy = 0, gz = 0;
+    for(int i=0;i<n;++i){
+        double dx = p[0]-cx[i], dy = p[1]-cy[i], dz = p[2]-cz[i];
+        double k, g, h;
+        ker.radial(dx*dx + dy*dy + dz*dz, k, g, h);
+        double du = ux[i]*dx + uy[i]*dy + uz[i]*dz;
+        acc += w[i]*k + g*du;
+        double s = w[i]*g + h*du;
+        gx += s*dx + g*ux[i];
+        gy += s*dy + g*uy[i];
+        gz += s*dz + g*uz[i];
+    }
+    grad[0] += gx;
+    grad[1] += gy;
+    grad[2] += gz;
+    return acc;
+}
+
+template <>
+inline double Kernel_ContractGradient<XCube_Policy>(const XCube_Policy &, const double *p, const double *cx, const double *cy, const double *cz,
+                                                    const double *w, const double *ux, const double *uy, const double *uz, int n, double *grad){
+    return XCubeSIMD::contractGradient(p,cx,cy,cz,w,ux,uy,uz,n,grad);
+}
+
+//acc[j] += Kernel_Contract of query j, the loop over the queries is innermost
+template <class Kernel>
+inline void Kernel_ContractBlock(const Kernel &ker, const double *qx, const double *qy, const double *qz, int nq,
+                                 const double *cx, const double *cy, const double *cz,
+                                 const double *w, const double *ux, const double *uy, const double *uz, int n, double *acc){
+    for(int i=0;i<n;++i){
+        for(int j=0;j<nq;++j){
+            double dx = qx[j]-cx[i], dy = qy[j]-cy[i], dz = qz[j]-cz[i];
+            double k, g, h;
+            ker.radial(dx*dx + dy*dy + dz*dz, k, g, h);
+            acc[j] += w[i]*k + g*(ux[i]*dx + uy[i]*dy + uz[i]*dz);
+        }
+    }
+}
+
+template <>
+inline void Kernel_ContractBlock<XCube_Policy>(const XCube_Policy &, const double *qx, const double *qy, const double *qz, int nq,
+                                               const double *cx, const double *cy, const double *cz,
+                                               const double *w, const double *ux, const double *uy, const double *uz, int n, double *acc){
+    XCubeSIMD::contractBlock(qx,qy,qz,nq,cx,cy,cz,w,ux,uy,uz,n,acc);
+}
+
+
+
+#endif // RBF_KERNELS_H
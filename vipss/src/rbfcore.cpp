@@ -52,7 +52,7 @@ double Gaussian_PKernel_Bending_2p(const double *p1, const double *p2){
 
 double XCube_Kernel(const double x){
 
-    return pow(x,3);
+    return x*x*x;
 }
 
 double XCube_Kernel_2p(const double *p1, const double *p2){
@@ -182,6 +182,7 @@ void RBF_Core::Init(RBF_Kernal kernal){
 }
 
 void RBF_Core::SetSigma(double x){
+    kernal_sigma = x;
     sigma = x;
     inv_sigma_squarex2 = 1/(2 * pow(sigma, 2));
 }
@@ -197,54 +198,51 @@ double RBF_Core::Dist_Function(const double x, const double y, const double z){
 
 inline double RBF_Core::Dist_Function(const double *p){
 
-    n_evacalls++;
-    double *p_pts = pts.data();
-    static arma::vec kern(npt), kb;
-    if(isHermite){
-        kern.set_size(npt*4);
-        double G[3];
-        for(int i=0;i<npt;++i)kern(i) = Kernal_Function_2p(p_pts+i*3, p);
-        for(int i=0;i<npt;++i){
-            Kernal_Gradient_Function_2p(p,p_pts+i*3,G);
-            //for(int j=0;j<3;++j)kern(npt+i*3+j) = -G[j];
-            for(int j=0;j<3;++j)kern(npt+i+j*npt) = G[j];
-        }
-    }else{
-        kern.set_size(npt);
-        for(int i=0;i<npt;++i)kern(i) = Kernal_Function_2p(p_pts+i*3, p);
-    }
+    return evaluator.Evaluate(p);
 
-    double loc_part = dot(kern,a);
-
-    if(polyDeg==1){
-        kb.set_size(4);
-        for(int i=0;i<3;++i)kb(i+1) = p[i];
-        kb(0) = 1;
-    }else if(polyDeg==2){
-        vector<double>buf(4,1);
-        int ind = 0;
-        kb.set_size(10);
-        for(int j=0;j<3;++j)buf[j+1] = p[j];
-        for(int j=0;j<4;++j)for(int k=j;k<4;++k)kb(ind++) = buf[j] * buf[k];
-    }
-    double poly_part = dot(kb,b);
-
-    if(0){
-        cout<<"dist: "<<p[0]<<' '<<p[1]<<' '<<p[2]<<' '<<p_pts[3]<<' '<<p_pts[4]<<' '<<p_pts[5]<<' '<<
-              Kernal_Function_2p(p,p_pts+3)<<endl;
-        for(int i=0;i<npt;++i)cout<<kern(i)<<' ';
-        for(int i=0;i<bsize;++i)cout<<kb(i)<<' ';
-        cout<<endl;
-    }
+}
+static RBF_Core * s_hrbf;
+double RBF_Core::Dist_Function(const R3Pt &in_pt){
+    return s_hrbf->Dist_Function(&(in_pt[0]));
+}
 
-    double re = loc_part + poly_part;
+double RBF_Core::Dist_Function_Gradient(const R3Pt &in_pt, R3Vec &out_grad){
+    double G[3];
+    double re = s_hrbf->evaluator.EvaluateGradient(&(in_pt[0]), G);
+    for(int i=0;i<3;++i)out_grad[i] = G[i];
     return re;
+}
 
+void RBF_Core::Dist_Function_Batch(const double *p, int m, double *out){
+    s_hrbf->evaluator.Evaluate(p, m, out, s_hrbf->n_threads);
+}
 
+double RBF_Core::Dist_Function_Cached(const R3Pt &in_pt){
+    return s_hrbf->sdfcache.Evaluate(&(in_pt[0]));
 }
-static RBF_Core * s_hrbf;
-double RBF_Core::Dist_Function(const R3Pt &in_pt){
-    return s_hrbf->Dist_Function(&(in_pt[0]));
+
+double RBF_Core::Dist_Function_Gradient_Cached(const R3Pt &in_pt, R3Vec &out_grad){
+    double G[3];
+    double re = s_hrbf->sdfcache.EvaluateGradient(&(in_pt[0]), G);
+    for(int i=0;i<3;++i)out_grad[i] = G[i];
+    return re;
+}
+
+void RBF_Core::Dist_Function_Batch_Cached(const double *p, int m, double *out){
+    s_hrbf->sdfcache.Evaluate(p, m, out, s_hrbf->n_threads);
+}
+
+void RBF_Core::Surfacing_Preview(int n_voxels, vector<double>&v, vector<uint>&fv, vector<double>&vn){
+    if(s_hrbf->surf_previewproc)s_hrbf->surf_previewproc(n_voxels, v, fv, vn);
+    else if(!s_hrbf->surf_previewname.empty())
+        writePLYFile_VNF(s_hrbf->surf_previewname+"_"+to_string(n_voxels), v, vn, fv);
+}
+
+bool RBF_Core::Surfacing_Continue(){
+    if(s_hrbf->surf_evallimit>0 && s_hrbf->evaluator.Evaluations()>s_hrbf->surf_evallimit)return false;
+    if(s_hrbf->surf_deadline>0 && std::chrono::duration<double>(
+                std::chrono::steady_clock::now().time_since_epoch()).count()>s_hrbf->surf_deadline)return false;
+    return true;
 }
 
 //FT RBF_Core::Dist_Function(const Point_3 in_pt){
@@ -261,7 +259,7 @@ void RBF_Core::Write_Surface(string fname){
 
     //writeObjFile(fname,finalMesh_v,finalMesh_fv);
 
-    writePLYFile_VF(fname,finalMesh_v,finalMesh_fv);
+    writePLYFile_VNF(fname,finalMesh_v,finalMesh_vn,finalMesh_fv);
 }
 
 /**********************************************************/
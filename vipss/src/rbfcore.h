@@ -7,6 +7,10 @@
 #include <iostream>
 #include <vector>
 #include "Solver.h"
+#include "symmatrix.h"
+#include "rbf_kernels.h"
+#include "rbf_evaluator.h"
+#include "sdfcache.h"
 #include "ImplicitedSurfacing.h"
 //#include "eigen3/Eigen/Dense"
 #include <armadillo>
@@ -55,24 +59,29 @@ enum RBF_InitMethod{
     RBF_Init_EMPTY
 };
 
-enum RBF_Kernal{
-    XCube,
-    ThinSpline,
-    XLinear,
-    Gaussian,
-};
-
 class RBF_Paras{
 public:
     RBF_METHOD Method;
     RBF_Kernal Kernal;
     RBF_InitMethod InitMethod;
     bool isusesparse;
+    bool isusenullspace = false;
     int polyDeg;
     double sigma;
     double user_lamnbda;
     double rangevalue;
     double sparse_para = 1e-3;
+    int n_threads = 0;
+    int n_search_threads = 0;
+    int singleprecision = 0;
+    int optbackend = 0;
+    int n_multistart = 1;
+    bool isanalyticgrad = false;
+    bool isgridsurfacing = false;
+    double octree_tol = 0;
+    double surf_timebudget = 0;
+    long long surf_evalbudget = 0;
+    int surf_previews = 0;
     double Hermite_weight_smoothness;
     double Hermite_ls_weight;
     double Hermite_designcurve_weight;
@@ -87,6 +96,25 @@ public:
 
 
 
+//state of one run of optfunc_Hermite, kept out of RBF_Core so that runs can be concurrent;
+//the buffers are sized once by init, so the objective does not allocate
+class Hermite_OptContext{
+public:
+    const SymMatrix *H = NULL;
+    int npt = 0;
+    int n_threads = 1;
+    int countopt = 0;
+    double acc_time = 0;
+
+    vector<double>sinx, cosx;
+    vector<double>x3, Hx;
+    vector<double>Xk, HXk;
+    vector<double>symv_work;
+    int countbatch = 0;
+
+    void init(const SymMatrix *H, int npt, int n_threads);
+};
+
 class RBF_Core{
 
 public:
@@ -102,6 +130,7 @@ public:
     double User_Lamnbda;
 
     RBF_Kernal kernal;
+    double kernal_sigma = 2.0;
     RBF_METHOD curMethod;
     RBF_InitMethod curInitMethod;
 
@@ -131,6 +160,7 @@ public:
 public:
     vector<double>finalMesh_v;
     vector<uint>finalMesh_fv;
+    vector<double>finalMesh_vn;
 
 public:
 
@@ -145,8 +175,8 @@ public:
     arma::mat K;
     arma::mat bprey;
     arma::mat saveK;
-    arma::mat saveK_finalH;
-    arma::mat finalH;
+    SymMatrix finalH;
+    SymMatrix finalH_single;
 
     arma::mat RQ;
 
@@ -156,11 +186,67 @@ public:
     arma::mat K00;
     arma::mat K01;
     arma::mat K11;
-    arma::mat dI;
+    arma::vec K00_d;
+    arma::mat K00_V;
+    arma::mat K00_W;
+    bool isK00_spectral = false;
+    bool isK00_spectralfailed = false;  //eig_sym of K00 failed, Set_K00_Spectral is not tried again
+    arma::mat MN;
+    arma::mat NtN;
 
 
     bool isuse_sparse = false;
     double sparse_para = 1e-3;
+    bool isuse_nullspace = false;
+
+    int n_threads = 1;
+    int n_search_threads = 0;
+
+    //0: double finalH, 1: float copy of finalH for the optimization followed by a double polish,
+    //2: as 1 and compared with the double optimization
+    int singleprecision = 0;
+
+    //0: nlopt on the spherical angles, 1: Solver::sphereLBFGS on the unit normals,
+    //2: as 0 and the two are reported side by side
+    int optbackend = 0;
+
+    //>1: the lambda search candidates, and n_multistart starts in OptNormal, are optimized as one
+    //batch by Solver::sphereLBFGSBatch
+    int n_multistart = 1;
+
+    //surfacing with the closed form gradient: Newton steps for the edge crossings and gradient normals
+    bool isanalyticgrad = false;
+
+    //surfacing by a sweep of the whole grid (all components), with batched evaluation
+    bool isgridsurfacing = false;
+
+    //>0: surfacing by an octree refined near the surface, until the function is linear within
+    //octree_tol voxels over each cube, then dual contoured (all components)
+    double octree_tol = 0;
+
+    //>0: the surfacing resolution is the highest expected to fit in surf_timebudget seconds or
+    //surf_evalbudget evaluations (from a calibration pass), see Surfacing_Budget
+    double surf_timebudget = 0;
+    long long surf_evalbudget = 0;
+
+    //limits of the current surfacing pass, checked by Surfacing_Continue (0: none)
+    double surf_deadline = 0;
+    long long surf_evallimit = 0;
+
+    //>0: progressive surfacing, by the octree of octree_tol (0: refined everywhere near the surface),
+    //with surf_previews coarser surfaces first, of n/2^surf_previews, ..., n/2 voxels per line. Each
+    //is handed to surf_previewproc if set, else written to surf_previewname_<voxels>.ply
+    int surf_previews = 0;
+    void (*surf_previewproc)(int n_voxels, vector<double>&v, vector<uint>&fv, vector<double>&vn) = NULL;
+    string surf_previewname;
+
+    //with surf_cachename, the surfacing and the queries sample the function through sdfcache, which is
+    //loaded from and saved to that file: surfacing the same model again evaluates the RBF only where no
+    //brick was cached (the lattice is the grid of the surfacing that created the file, rebuilt by a finer one)
+    string surf_cachename;
+    SDFBrickCache sdfcache;
+
+    Hermite_OptContext optctx;
 
 public:
     unordered_map<int, string>mp_RBF_INITMETHOD;
@@ -211,8 +297,16 @@ public:
 
 public:
     static double Dist_Function(const R3Pt &in_pt);
+    static double Dist_Function_Gradient(const R3Pt &in_pt, R3Vec &out_grad);
+    static void Dist_Function_Batch(const double *p, int m, double *out);
+    static double Dist_Function_Cached(const R3Pt &in_pt);
+    static double Dist_Function_Gradient_Cached(const R3Pt &in_pt, R3Vec &out_grad);
+    static void Dist_Function_Batch_Cached(const double *p, int m, double *out);
     //static FT Dist_Function(const Point_3 in_pt);
-    int n_evacalls;
+    long long n_evacalls;
+
+    //const copy of the solved function, refreshed by Set_RBFCoef; Dist_Function evaluates through it
+    RBF_Evaluator evaluator;
 public:
     void SetThis();
 public:
@@ -233,10 +327,12 @@ public:
 
 public:
     void Set_Hermite_PredictNormal(vector<double>&pts);
+    bool Set_Hermite_NullspaceK();
 
 public:
 
     int Solve_Hermite_PredictNormal_UnitNorm();
+    int Solve_Hermite_PredictNormal_UnitNorm(const arma::mat &Kin, vector<double> &init_normals);
 
 
     int Lamnbda_Search_GlobalEigen();
@@ -258,6 +354,9 @@ public:
 
     void Set_Actual_Hermite_LSCoef(double hermite_ls);
     void Set_HermiteApprox_Lamnda(double hermite_ls);
+    void Get_HermiteApprox_K(double hermite_ls, arma::mat &Kout);
+    void Set_K00_Spectral();
+    void Get_Lamnbda_K(double lamnbda, arma::mat &Kout);
     void Set_Actual_User_LSCoef(double user_ls);
     void Set_User_Lamnda_ToMatrix(double user_ls);
 
@@ -279,6 +378,11 @@ public:
 public:
 
     int Opt_Hermite_PredictNormal_UnitNormal();
+    int Opt_Hermite_PredictNormal_UnitNormal(const vector<double> &init_normals, vector<double> &opt_normals, Solution_Struct &rsol, Hermite_OptContext &ctx, int n_symv_threads, bool isusesingle, int backend);
+    void Opt_Hermite_Batch(const vector<vector<double>> &init_normals, vector<vector<double>> &opt_normals, vector<Solution_Struct> &rsols, Hermite_OptContext &ctx, int n_symv_threads, bool isusesingle);
+    void Opt_Hermite_MultiStart(int n_start);
+    void Opt_Hermite_Backend(int backend, const SymMatrix *H, const vector<double> &init_normals, vector<double> &opt_normals, Solution_Struct &rsol, Hermite_OptContext &ctx, int n_symv_threads);
+    void Set_FinalH_Single();
 
 public:
 
@@ -295,7 +399,26 @@ public:
 
     void OptNormal(int method);
 
-    void Surfacing(int method, int n_voxels_1d);
+    //with streamfname, the surface is written to streamfname.ply (binary) as it is produced, and
+    //finalMesh_v/fv stay empty
+    void Surfacing(int method, int n_voxels_1d, string streamfname = "");
+
+    //Surfacing with a time or evaluation budget: a pass at SURF_CALIBRATION voxels measures the cost,
+    //then the pass at the highest resolution (up to n_voxels_1d) expected to fit is run, and aborted
+    //if it exceeds the budget, keeping the calibration mesh
+    void Surfacing_Budget(int n_voxels_1d, string streamfname = "");
+
+    double SurfacingPass(Surfacer &sf, int n_voxels_1d);
+    static bool Surfacing_Continue();
+    static void Surfacing_Preview(int n_voxels, vector<double>&v, vector<uint>&fv, vector<double>&vn);
+
+    //loads sdfcache from surf_cachename; with n_voxels_1d>0, if there is none or it is coarser than the
+    //grid of n_voxels_1d (see SDFBrickCache::Covers), starts it on that grid. SaveSDFCache writes it back
+    //if bricks were added
+    void PrepareSDFCache(int n_voxels_1d);
+    void SaveSDFCache();
+
+    void Evaluate_Points(const vector<double> &query, vector<double> &values);
 
     void BuildCoherentGraph();
 
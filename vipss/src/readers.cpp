@@ -4,6 +4,7 @@
 #include<fstream>
 #include<sstream>
 #include<assert.h>
+#include<cstring>
 using namespace std;
 
 bool readOffFile(string filename,vector<double>&vertices,vector<unsigned int>&faces2vertices){
@@ -180,6 +181,113 @@ bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<
 }
 
 
+bool writePLYFile_VNF(string filename,const vector<double>&vertices, const vector<double>&vertices_normal,
+                      const vector<unsigned int>&faces2vertices){
+    filename = filename + ".ply";
+    ofstream outer(filename.data(), ofstream::out);
+    if (!outer.good()) {
+        cout << "Can not create output PLY file " << filename << endl;
+        return false;
+    }
+
+    int n_vertices = vertices.size()/3;
+    int n_faces = faces2vertices.size()/3;
+    outer << "ply" <<endl;
+    outer << "format ascii 1.0"<<endl;
+    outer << "element vertex " << n_vertices <<endl;
+    outer << "property float x" <<endl;
+    outer << "property float y" <<endl;
+    outer << "property float z" <<endl;
+    outer << "property float nx" <<endl;
+    outer << "property float ny" <<endl;
+    outer << "property float nz" <<endl;
+    outer << "element face " << n_faces <<endl;
+    outer << "property list uchar int vertex_indices" <<endl;
+    outer << "end_header" <<endl;
+
+    for(int i=0;i<n_vertices;++i){
+        auto p_v = vertices.data()+i*3;
+        auto p_vn = vertices_normal.data()+i*3;
+        for(int j=0;j<3;++j)outer << p_v[j] << " ";
+        for(int j=0;j<3;++j)outer << p_vn[j] << " ";
+        outer << "\n";
+    }
+
+    for(int i=0;i<n_faces;++i){
+        auto p_fv = faces2vertices.data()+i*3;
+        outer << "3 ";
+        for(int j=0;j<3;++j)outer << p_fv[j] << " ";
+        outer << "\n";
+    }
+    outer.close();
+    cout<<"saving finish: "<<filename<<endl;
+    return true;
+}
+
+static const int PLYCOUNTWIDTH = 20;   //room for the counts in the header, patched at Close
+
+bool PLYStreamWriter::Open(string filename){
+    Close();
+    fname = filename + ".ply";
+    fp = fopen(fname.data(), "wb");
+    fp_faces = fopen((fname + ".faces").data(), "w+b");
+    if (fp == NULL || fp_faces == NULL) {
+        cout << "Can not create output PLY file " << fname << endl;
+        if(fp)fclose(fp);
+        if(fp_faces){fclose(fp_faces); remove((fname + ".faces").data());}
+        fp = fp_faces = NULL;
+        return false;
+    }
+    n_vertices = n_faces = 0;
+
+    const unsigned int one = 1;
+    bool islittle = *(const unsigned char *)&one == 1;
+    fprintf(fp, "ply\nformat %s 1.0\nelement vertex ", islittle ? "binary_little_endian" : "binary_big_endian");
+    vertexcountpos = ftell(fp);
+    fprintf(fp, "%-*d\nproperty float x\nproperty float y\nproperty float z\n", PLYCOUNTWIDTH, 0);
+    fprintf(fp, "property float nx\nproperty float ny\nproperty float nz\nelement face ");
+    facecountpos = ftell(fp);
+    fprintf(fp, "%-*d\nproperty list uchar int vertex_indices\nend_header\n", PLYCOUNTWIDTH, 0);
+    return true;
+}
+
+void PLYStreamWriter::AddVertex(const double *v, const double *vn){
+    float p[6] = {float(v[0]), float(v[1]), float(v[2]), float(vn[0]), float(vn[1]), float(vn[2])};
+    fwrite(p, sizeof(float), 6, fp);
+    n_vertices++;
+}
+
+void PLYStreamWriter::AddFace(unsigned int i1, unsigned int i2, unsigned int i3){
+    unsigned char face[13];
+    int ids[3] = {int(i1), int(i2), int(i3)};
+    face[0] = 3;
+    memcpy(face+1, ids, sizeof(ids));
+    fwrite(face, 1, sizeof(face), fp_faces);
+    n_faces++;
+}
+
+bool PLYStreamWriter::Close(){
+    if(fp == NULL)return true;
+
+    vector<char> buf(1<<20);
+    size_t n;
+    bool isok = fflush(fp_faces) == 0 && fseek(fp_faces, 0, SEEK_SET) == 0;
+    while(isok && (n = fread(buf.data(), 1, buf.size(), fp_faces)) > 0)
+        isok = fwrite(buf.data(), 1, n, fp) == n;
+    fclose(fp_faces);
+    remove((fname + ".faces").data());
+
+    isok = isok && fseek(fp, vertexcountpos, SEEK_SET) == 0 && fprintf(fp, "%-*lld", PLYCOUNTWIDTH, n_vertices) > 0;
+    isok = isok && fseek(fp, facecountpos, SEEK_SET) == 0 && fprintf(fp, "%-*lld", PLYCOUNTWIDTH, n_faces) > 0;
+    isok = fclose(fp) == 0 && isok;
+    fp = fp_faces = NULL;
+
+    if(isok)cout<<"saving finish: "<<fname<<endl;
+    else cout << "Can not write output PLY file " << fname << endl;
+    return isok;
+}
+
+
 bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal){
     filename = filename + ".ply";
     ofstream outer(filename.data(), ofstream::out);
@@ -1003,6 +1111,23 @@ bool readVecFile(string filename,vector<float>&vec){
     return true;
 
 }
+bool writeVecFile(string filename, const vector<double>&vec){
+    filename = filename + "_vec.txt";
+    ofstream fout(filename.data());
+    if(fout.fail()){
+        cout<<"Fail to create output file: "<<filename<<endl;
+        return false;
+    }
+
+    int numof = vec.size();
+    fout<<numof<<endl;
+    fout<<setprecision(17);
+    for(auto a:vec)fout<<a<<endl;
+    fout.close();
+
+    cout<<"Write: "<<filename<<endl;
+    return true;
+}
 bool readVecFile(string filename,vector<double>&vec){
     ifstream reader(filename.data(), ifstream::in);
     if (!reader.good()) {
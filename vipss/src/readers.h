@@ -4,6 +4,7 @@
 
 #include<vector>
 #include<string>
+#include<cstdio>
 using namespace std;
 
 bool readOffFile(string filename,vector<double>&vertices,vector<unsigned int>&faces2vertices);
@@ -16,9 +17,31 @@ bool writePLYFile(string filename, const vector<double>&vertices, const vector<u
 
 bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices);
 bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal);
+bool writePLYFile_VNF(string filename,const vector<double>&vertices, const vector<double>&vertices_normal,
+                      const vector<unsigned int>&faces2vertices);
 
 bool readPLYFile(string filename,  vector<double>&vertices, vector<double> &vertices_normal);
 
+//binary PLY (float x y z nx ny nz, int triangles) written as it is produced: the vertices go to the file and
+//the faces to filename.faces, which is appended at Close; the counts are patched into the header then
+class PLYStreamWriter{
+public:
+    PLYStreamWriter(){}
+    ~PLYStreamWriter(){Close();}
+
+    bool Open(string filename);
+    void AddVertex(const double *v, const double *vn);
+    void AddFace(unsigned int i1, unsigned int i2, unsigned int i3);
+    bool Close();
+
+    long long n_vertices = 0, n_faces = 0;
+
+private:
+    string fname;
+    FILE *fp = NULL, *fp_faces = NULL;
+    long vertexcountpos = 0, facecountpos = 0;
+};
+
 bool readObjFile(string filename, vector<double>&vertices, vector<unsigned int>&faces2vertices, vector<double> &vertices_normal);
 bool readObjFile_Line(string filename,vector<double>&vertices,vector<unsigned int>&edges2vertices);
 
@@ -60,6 +83,7 @@ bool writeVecFile(string filename, const vector<float>&vec);
 bool readVecFile(string filename,vector<float>&vec);
 
 
+bool writeVecFile(string filename, const vector<double>&vec);
 bool readVecFile(string filename,vector<double>&vec);
 
 bool readVVecFile(string filename, vector<vector<double>> &vvec);
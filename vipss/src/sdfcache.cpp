@@ -0,0 +1,294 @@
+#include "sdfcache.h"
+#include "utility.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+
+static const char SDFCACHE_MAGIC[8] = {'V','I','P','S','S','D','F','2'};
+static const int64_t KEY_OFFSET = 1<<20;   //brick coordinates are kept in 21 bits each
+
+static uint64_t BrickKey(int64_t bi, int64_t bj, int64_t bk){
+    auto clamp21 = [](int64_t b){return uint64_t(min(max(b+KEY_OFFSET, int64_t(0)), 2*KEY_OFFSET-1));};
+    return (clamp21(bi)<<42) | (clamp21(bj)<<21) | clamp21(bk);
+}
+
+static void BrickCoords(uint64_t key, int64_t *b){
+    b[0] = int64_t(key>>42) - KEY_OFFSET;
+    b[1] = int64_t((key>>21) & (2*KEY_OFFSET-1)) - KEY_OFFSET;
+    b[2] = int64_t(key & (2*KEY_OFFSET-1)) - KEY_OFFSET;
+}
+
+//FNV-1a of the centers, coefficients and kernel
+uint64_t SDFBrickCache::Fingerprint(const RBF_Evaluator &evaluator){
+
+    uint64_t h = 14695981039346656037ULL;
+    auto hash = [&h](const void *data, size_t n){
+        auto c = (const unsigned char *)data;
+        for(size_t i=0;i<n;++i){h ^= c[i]; h *= 1099511628211ULL;}
+    };
+    hash(&evaluator.npt, sizeof(int));
+    hash(&evaluator.polyDeg, sizeof(int));
+    hash(&evaluator.kernal, sizeof(RBF_Kernal));
+    hash(&evaluator.sigma, sizeof(double));
+    for(auto v:{&evaluator.cx,&evaluator.cy,&evaluator.cz,&evaluator.w,&evaluator.ux,&evaluator.uy,&evaluator.uz,&evaluator.b})
+        hash(v->data(), v->size()*sizeof(double));
+    return h;
+}
+
+void SDFBrickCache::Reset(const RBF_Evaluator &evaluator, const double *origin, double spacing){
+
+    p_evaluator = &evaluator;
+    fingerprint = Fingerprint(evaluator);
+    for(int i=0;i<3;++i)this->origin[i] = origin[i];
+    this->spacing = spacing;
+    for(auto &shard:bricks)shard.clear();
+    for(auto &shard:missed)shard.clear();
+    n_newbricks = 0;
+}
+
+bool SDFBrickCache::Covers(const double *origin, double spacing) const{
+
+    const double eps = 1e-6;
+    double ratio = spacing/this->spacing;
+    if(ratio < 1-eps || fabs(ratio-floor(ratio+0.5)) > eps*ratio)return false;
+    for(int i=0;i<3;++i){
+        double x = (origin[i]-this->origin[i])/this->spacing;
+        if(fabs(x-floor(x+0.5)) > eps)return false;
+    }
+    return true;
+}
+
+size_t SDFBrickCache::Bricks() const{
+
+    size_t n = 0;
+    for(int i=0;i<Shards;++i){
+        lock_guard<mutex> guard(locks[i]);
+        n += bricks[i].size();
+    }
+    return n;
+}
+
+//key of the brick of the cell of p, and the lattice coordinates of p in the brick in t (0..Brick)
+uint64_t SDFBrickCache::Locate(const double *p, double *t) const{
+
+    int64_t b[3];
+    for(int i=0;i<3;++i){
+        double x = (p[i]-origin[i])/spacing;
+        b[i] = int64_t(floor(x/Brick));
+        t[i] = x - double(b[i]*Brick);
+    }
+    return BrickKey(b[0],b[1],b[2]);
+}
+
+//the values of a brick stay at the same address once inserted (the map is node based and never erased
+//while in use), so they are read without the lock
+const float *SDFBrickCache::Find(uint64_t key) const{
+
+    int s = Shard(key);
+    lock_guard<mutex> guard(locks[s]);
+    auto it = bricks[s].find(key);
+    return it==bricks[s].end() ? NULL : it->second.data();
+}
+
+//true at the first miss of a brick
+bool SDFBrickCache::Miss(uint64_t key){
+
+    int s = Shard(key);
+    lock_guard<mutex> guard(locks[s]);
+    return missed[s].insert(key).second;
+}
+
+const float *SDFBrickCache::Fill(uint64_t key, const float *values){
+
+    int s = Shard(key);
+    lock_guard<mutex> guard(locks[s]);
+    auto re = bricks[s].emplace(key, vector<float>());
+    if(re.second){
+        re.first->second.assign(values, values+BrickValues);
+        ++n_newbricks;
+    }
+    return re.first->second.data();
+}
+
+void SDFBrickCache::LatticePoints(uint64_t key, double *p) const{
+
+    int64_t b[3];
+    BrickCoords(key, b);
+    for(int i=0;i<=Brick;++i)for(int j=0;j<=Brick;++j)for(int k=0;k<=Brick;++k,p+=3){
+        p[0] = origin[0] + double(b[0]*Brick+i)*spacing;
+        p[1] = origin[1] + double(b[1]*Brick+j)*spacing;
+        p[2] = origin[2] + double(b[2]*Brick+k)*spacing;
+    }
+}
+
+//values and gradients at the lattice points of the nb bricks of keys, BrickValues floats per brick
+void SDFBrickCache::EvaluateBricks(const uint64_t *keys, size_t nb, float *values, int n_threads) const{
+
+    MyUtility::parallelFor(int(nb), n_threads, [&](int i, int){
+        double pts[BrickPoints*3], grad[3];
+        RBF_Evaluator::Scratch scratch;
+        float *v = values + size_t(i)*BrickValues;
+        LatticePoints(keys[i], pts);
+        for(int k=0;k<BrickPoints;++k){
+            v[k] = float(p_evaluator->EvaluateGradient(pts+3*k, grad, scratch));
+            for(int d=0;d<3;++d)v[(d+1)*BrickPoints+k] = float(grad[d]);
+        }
+        p_evaluator->AddEvaluations(scratch);
+    });
+}
+
+static inline double Trilinear(const float *v, const double *t){
+
+    const int S = SDFBrickCache::Brick+1;
+    int c[3];
+    double f[3];
+    for(int i=0;i<3;++i){
+        c[i] = min(max(int(t[i]), 0), SDFBrickCache::Brick-1);
+        f[i] = t[i]-c[i];
+    }
+    const float *v0 = v + (c[0]*S + c[1])*S + c[2];
+    double v000 = v0[0], v001 = v0[1], v010 = v0[S], v011 = v0[S+1];
+    double v100 = v0[S*S], v101 = v0[S*S+1], v110 = v0[S*S+S], v111 = v0[S*S+S+1];
+
+    double v00 = v000 + f[2]*(v001-v000), v01 = v010 + f[2]*(v011-v010);
+    double v10 = v100 + f[2]*(v101-v100), v11 = v110 + f[2]*(v111-v110);
+    double v0_ = v00 + f[1]*(v01-v00), v1_ = v10 + f[1]*(v11-v10);
+    return v0_ + f[0]*(v1_-v0_);
+}
+
+double SDFBrickCache::Evaluate(const double *p){
+
+    return EvaluateGradient(p, NULL);
+}
+
+//a brick is added at its second miss, the first point is evaluated directly: the searches along long
+//edges (of the coarse cubes of the octree) touch many bricks once, the tracker touches the same ones again
+double SDFBrickCache::EvaluateGradient(const double *p, double *grad){
+
+    double t[3];
+    uint64_t key = Locate(p, t);
+    const float *v = Find(key);
+    if(!v){
+        if(Miss(key))return grad ? p_evaluator->EvaluateGradient(p, grad) : p_evaluator->Evaluate(p);
+        float values[BrickValues];
+        EvaluateBricks(&key, 1, values, 1);
+        v = Fill(key, values);
+    }
+    //the gradient is interpolated from the gradients at the lattice points: the gradient of the trilinear
+    //values jumps across the cells and would facet the normals
+    if(grad)for(int i=0;i<3;++i)grad[i] = Trilinear(v+(i+1)*BrickPoints, t);
+    return Trilinear(v, t);
+}
+
+void SDFBrickCache::Evaluate(const double *p, size_t m, double *out, int n_threads, bool isfill){
+
+    if(m==0)return;
+    vector<uint64_t>keys(m);
+    vector<double>t(m*3);
+    vector<const float*>v(m);
+    for(size_t j=0;j<m;++j){
+        keys[j] = Locate(p+3*j, t.data()+3*j);
+        v[j] = Find(keys[j]);
+    }
+
+    //the points out of the cached bricks are evaluated directly; with isfill, the bricks where these
+    //values change sign (the bricks of the zero set) are added, the others are left to the single point
+    //Evaluate, so that sweeps of a whole volume do not fill it
+    vector<size_t>missing;
+    for(size_t j=0;j<m;++j)if(!v[j])missing.push_back(j);
+    if(!missing.empty()){
+        vector<double>pts(missing.size()*3), vals(missing.size());
+        for(size_t i=0;i<missing.size();++i)memcpy(pts.data()+3*i, p+3*missing[i], 3*sizeof(double));
+        p_evaluator->Evaluate(pts.data(), missing.size(), vals.data(), n_threads);
+        for(size_t i=0;i<missing.size();++i)out[missing[i]] = vals[i];
+    }
+    if(!missing.empty() && isfill){
+        vector<pair<uint64_t,int>>signs;
+        for(auto j:missing)signs.push_back(make_pair(keys[j], out[j]>0 ? 1 : 0));
+        sort(signs.begin(), signs.end());
+        signs.erase(unique(signs.begin(), signs.end()), signs.end());
+        vector<uint64_t>newkeys;
+        for(size_t i=1;i<signs.size();++i)if(signs[i].first==signs[i-1].first)newkeys.push_back(signs[i].first);
+
+        size_t nb = newkeys.size();
+        vector<float>values(nb*BrickValues);
+        EvaluateBricks(newkeys.data(), nb, values.data(), n_threads);
+        for(size_t i=0;i<nb;++i)Fill(newkeys[i], values.data()+i*BrickValues);
+        if(nb)for(auto j:missing)v[j] = Find(keys[j]);
+    }
+
+    const size_t block = 4096;
+    int n_blocks = int((m + block - 1) / block);
+    MyUtility::parallelFor(n_blocks, n_threads, [&](int b, int){
+        for(size_t j=b*block;j<min(m, (b+1)*block);++j)
+            if(v[j])out[j] = Trilinear(v[j], t.data()+3*j);
+    });
+}
+
+//file: magic, fingerprint (uint64), origin and spacing (double), Brick and the number of bricks (int64),
+//then for each brick its key (uint64) and BrickValues floats
+bool SDFBrickCache::Save(string filename) const{
+
+    FILE *fp = fopen(filename.data(), "wb");
+    if(!fp){
+        cout<<"Can not write the SDF cache "<<filename<<endl;
+        return false;
+    }
+    int64_t header[2] = {Brick, int64_t(Bricks())};
+    bool isok = fwrite(SDFCACHE_MAGIC, 1, 8, fp)==8 && fwrite(&fingerprint, sizeof(uint64_t), 1, fp)==1 &&
+            fwrite(origin, sizeof(double), 3, fp)==3 && fwrite(&spacing, sizeof(double), 1, fp)==1 &&
+            fwrite(header, sizeof(int64_t), 2, fp)==2;
+    for(int s=0;s<Shards && isok;++s){
+        lock_guard<mutex> guard(locks[s]);
+        for(auto &brick:bricks[s]){
+            isok = fwrite(&brick.first, sizeof(uint64_t), 1, fp)==1 &&
+                    fwrite(brick.second.data(), sizeof(float), BrickValues, fp)==BrickValues;
+            if(!isok)break;
+        }
+    }
+    fclose(fp);
+    if(!isok)cout<<"Error writing the SDF cache "<<filename<<endl;
+    return isok;
+}
+
+bool SDFBrickCache::Load(string filename, const RBF_Evaluator &evaluator){
+
+    FILE *fp = fopen(filename.data(), "rb");
+    if(!fp)return false;
+    char magic[8];
+    uint64_t fp_file;
+    double org[3], h;
+    int64_t header[2];
+    bool isok = fread(magic, 1, 8, fp)==8 && memcmp(magic, SDFCACHE_MAGIC, 8)==0 &&
+            fread(&fp_file, sizeof(uint64_t), 1, fp)==1 && fread(org, sizeof(double), 3, fp)==3 &&
+            fread(&h, sizeof(double), 1, fp)==1 && fread(header, sizeof(int64_t), 2, fp)==2 &&
+            header[0]==Brick && header[1]>=0 && h>0;
+    if(!isok){
+        fclose(fp);
+        cout<<"Not an SDF cache: "<<filename<<endl;
+        return false;
+    }
+    if(fp_file!=Fingerprint(evaluator)){
+        fclose(fp);
+        cout<<"SDF cache "<<filename<<" is of another function, ignored"<<endl;
+        return false;
+    }
+
+    Reset(evaluator, org, h);
+    uint64_t key;
+    vector<float>values(BrickValues);
+    for(int64_t i=0;i<header[1];++i){
+        if(fread(&key, sizeof(uint64_t), 1, fp)!=1 || fread(values.data(), sizeof(float), BrickValues, fp)!=BrickValues){
+            cout<<"SDF cache "<<filename<<" is truncated, "<<i<<" of "<<header[1]<<" bricks read"<<endl;
+            break;
+        }
+        Fill(key, values.data());
+    }
+    fclose(fp);
+    n_newbricks = 0;
+    cout<<"SDF cache "<<filename<<": "<<Bricks()<<" bricks, spacing "<<spacing<<endl;
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef SDFCACHE_H
+#define SDFCACHE_H
+
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <atomic>
+#include "rbf_evaluator.h"
+using namespace std;
+
+//sparse cache of an RBF_Evaluator on the lattice origin + (i,j,k)*spacing. The values and gradients are kept
+//in bricks of (Brick+1)^3 lattice points (Brick*b .. Brick*b+Brick on each axis, so that every cell is in one
+//brick), which are evaluated in one batch when needed near the zero set; both are trilinear in between. The
+//bricks are shared by all threads (locked by shards of keys) and can be saved to a binary file, tagged
+//with a fingerprint of the function, to be reused by later runs on the same model
+class SDFBrickCache{
+
+public:
+    static const int Brick = 4;
+    static const int BrickPoints = (Brick+1)*(Brick+1)*(Brick+1);
+    static const int BrickValues = 4*BrickPoints;   //the values, then the x, y and z of the gradients
+
+    double origin[3] = {0,0,0};
+    double spacing = 0;
+
+public:
+    SDFBrickCache(){}
+
+    //empty cache of evaluator on the lattice of origin and spacing
+    void Reset(const RBF_Evaluator &evaluator, const double *origin, double spacing);
+
+    //the bricks of filename, if it is a cache of this evaluator (false, and the cache unchanged, if not)
+    bool Load(string filename, const RBF_Evaluator &evaluator);
+    bool Save(string filename) const;
+
+    //true if the lattice of origin and spacing is a sublattice of the cache: the spacing is a multiple of
+    //the cache spacing and origin is a cache lattice point, so the cached values are at its points
+    bool Covers(const double *origin, double spacing) const;
+
+    bool empty() const {return p_evaluator==NULL;}
+    size_t Bricks() const;
+    size_t NewBricks() const {return n_newbricks;}
+
+    //trilinear value (and gradient) at p; a brick is evaluated at its second miss (before, p directly)
+    double Evaluate(const double *p);
+    double EvaluateGradient(const double *p, double *grad);
+
+    //out[j] for the m points p, by n_threads threads: the points out of the cached bricks are evaluated
+    //directly, and with isfill the bricks where they change sign are added
+    void Evaluate(const double *p, size_t m, double *out, int n_threads = 1, bool isfill = true);
+
+    static uint64_t Fingerprint(const RBF_Evaluator &evaluator);
+
+private:
+    static const int Shards = 64;
+
+    const RBF_Evaluator *p_evaluator = NULL;
+    uint64_t fingerprint = 0;
+    atomic<size_t> n_newbricks{0};
+
+    unordered_map<uint64_t, vector<float>> bricks[Shards];
+    unordered_set<uint64_t> missed[Shards];
+    mutable mutex locks[Shards];
+
+    uint64_t Locate(const double *p, double *t) const;
+    const float *Find(uint64_t key) const;
+    bool Miss(uint64_t key);
+    const float *Fill(uint64_t key, const float *values);
+    void LatticePoints(uint64_t key, double *p) const;
+    void EvaluateBricks(const uint64_t *keys, size_t nb, float *values, int n_threads) const;
+    static int Shard(uint64_t key){return int((key ^ (key>>21) ^ (key>>42)) % Shards);}
+};
+
+
+
+#endif // SDFCACHE_H
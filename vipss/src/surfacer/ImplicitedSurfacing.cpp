@@ -6,19 +6,69 @@ typedef std::chrono::high_resolution_clock Clock;
 
 static Surfacer *p_ImplicitSurfacer;
 
+static int n_finalvoxels;              //of the surface after the previews
+static Clock::time_point t_surfacing;
+
+static void StreamVertices(VERTICES vs) {
+    PLYStreamWriter *stream = p_ImplicitSurfacer->p_stream;
+    for (int &i = p_ImplicitSurfacer->n_streamed; i < vs.count; i++) {
+        double p[3] = {vs.ptr[i].position[0], vs.ptr[i].position[1], vs.ptr[i].position[2]};
+        double n[3] = {vs.ptr[i].normal[0], vs.ptr[i].normal[1], vs.ptr[i].normal[2]};
+        stream->AddVertex(p, n);
+    }
+}
+
+#define SURF_CHECKTRIS 1024
+
+static bool IsPreview() {
+    return p_ImplicitSurfacer->n_surfaces < p_ImplicitSurfacer->n_previews;
+}
+
 static int TriProc(int in_i1, int in_i2, int in_i3, VERTICES vs) {
-    const R3Pt pt = vs.ptr[in_i1].position;
-    p_ImplicitSurfacer->s_afaceSurface.addItem( R3Pt_i( in_i3, in_i2, in_i1 ) );
+    if (p_ImplicitSurfacer->p_continue && ++p_ImplicitSurfacer->n_tris % SURF_CHECKTRIS == 0 &&
+        !p_ImplicitSurfacer->p_continue()) {
+        p_ImplicitSurfacer->isaborted = true;
+        return 0;
+    }
+    if (p_ImplicitSurfacer->p_stream && !IsPreview()) {
+        StreamVertices(vs);
+        p_ImplicitSurfacer->p_stream->AddFace(in_i1, in_i3, in_i2);
+        return 1;
+    }
+    vector<uint> &fv = p_ImplicitSurfacer->all_fv;
+    if (fv.size() == fv.capacity())         /* about two faces a vertex */
+        fv.reserve(std::max(2*fv.capacity(), (size_t)6*vs.count));
+    fv.push_back(in_i1);                    /* ccw seen from the positive side */
+    fv.push_back(in_i3);
+    fv.push_back(in_i2);
     return 1;
 }
 
 static void VertProc(VERTICES vs) {
-    p_ImplicitSurfacer->s_aptSurface.need( vs.count );
-    p_ImplicitSurfacer->s_avecSurface.need( vs.count );
+    if (p_ImplicitSurfacer->p_stream && !IsPreview()) {
+        StreamVertices(vs);
+        return;
+    }
+    vector<double> &v = p_ImplicitSurfacer->all_v, &vn = p_ImplicitSurfacer->all_vn;
+    v.resize(3*(size_t)vs.count);
+    vn.resize(3*(size_t)vs.count);
     for ( int i = 0; i < vs.count; i++ ) {
-        p_ImplicitSurfacer->s_aptSurface[i] = vs.ptr[i].position;
-        p_ImplicitSurfacer->s_avecSurface[i] = vs.ptr[i].normal;
+        for ( int j = 0; j < 3; j++ ) {
+            v[3*i+j] = vs.ptr[i].position[j];
+            vn[3*i+j] = vs.ptr[i].normal[j];
+        }
     }
+    if (IsPreview()) {
+        Surfacer *sf = p_ImplicitSurfacer;
+        int n_voxels = n_finalvoxels >> (sf->n_previews-sf->n_surfaces);
+        cout<<"Preview: "<<n_voxels<<" voxels, "<<vs.count<<" vertices, "
+           <<std::chrono::nanoseconds(Clock::now() - t_surfacing).count()/1e9<<" s"<<endl;
+        if (sf->p_previewproc) sf->p_previewproc(n_voxels, v, sf->all_fv, vn);
+        v.clear();
+        vn.clear();
+        sf->all_fv.clear();
+    }
+    p_ImplicitSurfacer->n_surfaces++;
 }
 
 
@@ -64,7 +114,9 @@ void Surfacer::CalSurfacingPara(vector<double>&Vs, int nvoxels){
 
 
 double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeckall,
-                                    double (*function)(const R3Pt &in_pt)){
+                                    double (*function)(const R3Pt &in_pt),
+                                    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+                                    int n_threads){
 
     p_ImplicitSurfacer = this;
     ClearBuffer();
@@ -76,7 +128,9 @@ double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeck
     double thresDist = 1e-3;
 
     double re_time;
-    cout<<"Implicit Surfacing: "<<endl;
+    cout<<"Implicit Surfacing: ";
+    if(n_threads>0)cout<<"("<<n_threads<<" threads)";
+    cout<<endl;
 
     auto t1 = Clock::now();
 
@@ -84,8 +138,9 @@ double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeck
 
 
     if(!ischeckall){
-        polygonize(function, dSize, iBound, st, TriProc, VertProc);
-        GetCurSurface(all_v,all_fv);
+        if(n_threads>0)polygonize_seeded(function, gradient, dSize, iBound, st, Vs.data(), Vs.size()/3,
+                                         TriProc, VertProc, n_threads);
+        else polygonize_gradient(function, gradient, dSize, iBound, st, TriProc, VertProc);
     }else{
         cout << "Deprecated, Please seek to CGAL implicit surfacer for surfaces with multiple connected components" <<endl;
     }
@@ -99,6 +154,72 @@ double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeck
 }
 
 
+double Surfacer::Surfacing_Grid(vector<double>&Vs, int n_voxels,
+                                double (*function)(const R3Pt &in_pt),
+                                void (*batch)(const double *p, int m, double *out),
+                                double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+                                int n_threads){
+
+    p_ImplicitSurfacer = this;
+    ClearBuffer();
+
+    CalSurfacingPara(Vs, n_voxels);
+
+    double re_time;
+    cout<<"Grid Surfacing: ("<<2*iBound+1<<"^3 cubes, "<<n_threads<<" threads)"<<endl;
+
+    auto t1 = Clock::now();
+
+    //the budget also stops the sweep between blocks of evaluations
+    if(!polygonize_grid(function, gradient, batch, dSize, iBound, st, TriProc, VertProc, n_threads, p_continue) &&
+            p_continue && !p_continue())isaborted = true;
+
+    cout<<"Grid Surfacing Done."<<endl;
+    auto t2 = Clock::now();
+    cout << "Total Surfacing time: " <<  (re_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) <<endl;
+
+    return re_time;
+
+}
+
+
+double Surfacer::Surfacing_Octree(vector<double>&Vs, int n_voxels, double tol,
+                                  void (*batch)(const double *p, int m, double *out),
+                                  double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+                                  int n_threads, int previews){
+
+    p_ImplicitSurfacer = this;
+    ClearBuffer();
+
+    CalSurfacingPara(Vs, n_voxels);
+
+    int depth = 0;
+    while((1<<depth) < 2*iBound+1)++depth;
+    previews = min(previews, depth);
+
+    double re_time;
+    cout<<"Octree Surfacing: (tolerance "<<tol<<" voxels, "<<n_threads<<" threads";
+    if(previews>0)cout<<", "<<previews<<" previews";
+    cout<<")"<<endl;
+
+    auto t1 = Clock::now();
+    n_previews = previews;
+    n_finalvoxels = n_voxels;
+    t_surfacing = t1;
+
+    //the budget also stops the refinement between blocks of evaluations
+    if(!polygonize_octree(gradient, batch, dSize, iBound, st, tol, previews, TriProc, VertProc, n_threads, p_continue) &&
+            p_continue && !p_continue())isaborted = true;
+
+    cout<<"Octree Surfacing Done."<<endl;
+    auto t2 = Clock::now();
+    cout << "Total Surfacing time: " <<  (re_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) <<endl;
+
+    return re_time;
+
+}
+
+
 void Surfacer::WriteSurface(string fname){
 
     writeObjFile(fname,all_v,all_fv);
@@ -111,6 +232,16 @@ void Surfacer::WriteSurface(vector<double> &v, vector<uint>&fv){
     fv = all_fv;
 }
 
+void Surfacer::MoveSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn){
+
+    v = std::move(all_v);
+    fv = std::move(all_fv);
+    vn = std::move(all_vn);
+    all_v.clear();
+    all_fv.clear();
+    all_vn.clear();
+}
+
 void Surfacer::WriteSurface(vector<double> **v, vector<uint> **fv){
 
     *v = &all_v;
@@ -119,28 +250,13 @@ void Surfacer::WriteSurface(vector<double> **v, vector<uint> **fv){
 
 void Surfacer::ClearBuffer(){
 
-    ClearSingleComponentBuffer();
+    n_streamed = 0;
+    n_tris = 0;
+    isaborted = false;
+    n_previews = n_surfaces = 0;
     all_v.clear();
     all_fv.clear();
-}
-
-void Surfacer::ClearSingleComponentBuffer(){
-    s_aptSurface.clearcompletely();
-    s_avecSurface.clearcompletely();
-    s_afaceSurface.clearcompletely();
-}
-
-void Surfacer::GetCurSurface(vector<double>&v,vector<uint>&fv){
-
-    int beInd = v.size()/3;
-    for(int i=0;i<s_aptSurface.num();++i){
-        for(int j=0;j<3;++j)v.push_back( s_aptSurface[i][j] );
-    }
-
-    for(int i=0;i<s_afaceSurface.num();++i){
-        for(int j=0;j<3;++j)fv.push_back( beInd + s_afaceSurface[i][2-j]);
-    }
-
+    all_vn.clear();
 }
 
 
@@ -10,25 +10,61 @@ class Surfacer{
 public:
 
     R3Pt							s_ptMin, s_ptMax;
-    Array<R3Pt>					s_aptSurface;
-    Array<R3Vec>					s_avecSurface;
-    Array<R3Pt_i>				s_afaceSurface;
 
 
+    //the surface, filled by the polygonizer callbacks: vertices, faces and unit vertex normals
     vector<double>all_v;
     vector<uint>all_fv;
+    vector<double>all_vn;
 
     R3Pt st;
     double dSize;
     int iBound;
 
+    //if set, the surface is written to p_stream as it is produced instead of kept in all_v/all_fv
+    PLYStreamWriter *p_stream = NULL;
+    int n_streamed = 0;
+
+    //if set, called every SURF_CHECKTRIS triangles (and between blocks of evaluations of Surfacing_Grid
+    //and Surfacing_Octree); false aborts the surfacing, then isaborted is set
+    //and the buffers (or the stream) are incomplete
+    bool (*p_continue)() = NULL;
+    bool isaborted = false;
+    long long n_tris = 0;
+
+    //the coarser surfaces of Surfacing_Octree (n_previews of them, n_voxels per line each) are handed
+    //to p_previewproc as they are completed; the last surface is the result as usual
+    void (*p_previewproc)(int n_voxels, vector<double>&v, vector<uint>&fv, vector<double>&vn) = NULL;
+    int n_previews = 0, n_surfaces = 0;
+
 
     Surfacer(){}
 
     void CalSurfacingPara(vector<double>&Vs, int nvoxels);
 
+    //with gradient (value and gradient of function), the edge crossings use Newton steps and the
+    //vertex normals are the gradients, see polygonize_gradient. With n_threads > 0 the surface is
+    //followed from the points Vs, which lie on it, by polygonize_seeded (every component holding
+    //a point), then function and gradient must be thread-safe
     double Surfacing_Implicit(vector<double>&Vs, int n_voxels, bool ischeckall,
-                   double (*function)(const R3Pt &in_pt));
+                   double (*function)(const R3Pt &in_pt),
+                   double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad) = NULL,
+                   int n_threads = 0);
+
+    //all the components of the zero set in the grid of CalSurfacingPara, see polygonize_grid; batch
+    //evaluates function at m points (3*m coordinates)
+    double Surfacing_Grid(vector<double>&Vs, int n_voxels,
+                   double (*function)(const R3Pt &in_pt),
+                   void (*batch)(const double *p, int m, double *out),
+                   double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad) = NULL,
+                   int n_threads = 1);
+
+    //an octree refined near the zero set in the grid of CalSurfacingPara, dual contoured, see
+    //polygonize_octree; tol is in voxels, gradient is called concurrently on n_threads threads
+    double Surfacing_Octree(vector<double>&Vs, int n_voxels, double tol,
+                   void (*batch)(const double *p, int m, double *out),
+                   double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+                   int n_threads = 1, int previews = 0);
 
 
 
@@ -36,12 +72,12 @@ public:
     void WriteSurface(vector<double> &v, vector<uint>&fv);
     void WriteSurface(vector<double> **v, vector<uint>**fv);
 
-    void ClearBuffer();
+    //hands the surface over without copying, the buffers of the surfacer are left empty
+    void MoveSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn);
 
-    void ClearSingleComponentBuffer();
+    void ClearBuffer();
 
 private:
-    void GetCurSurface(vector<double> &v, vector<uint>&fv);
     void InsertToCurSurface(vector<double>&v,vector<uint>&fv);
 
 
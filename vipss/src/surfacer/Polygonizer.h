@@ -32,13 +32,98 @@ bool polygonize (
 	void (*vertproc)(VERTICES vertices)	
 	);
 
+/* as polygonize, gradient returns the function value and its gradient;
+   it is used for the edge roots and the vertex normals */
+bool polygonize_gradient (
+    double (*function)(const R3Pt &in_pt),
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    double size,
+	int bounds,
+    const R3Pt &in_ptStart,
+	int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices)
+	);
+
+/* as polygonize_gradient (gradient may be NULL), with n_threads threads
+   (function and gradient are called concurrently), the surface followed
+   from nseeds points on it (3*nseeds coordinates) instead of a random
+   search, one front for each component within the cubes |i|, |j|, |k| <=
+   bounds around in_ptCenter that holds a seed */
+bool polygonize_seeded (
+    double (*function)(const R3Pt &in_pt),
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    double size,
+	int bounds,
+    const R3Pt &in_ptCenter,
+    const double *seeds,
+    int nseeds,
+	int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices),
+	int n_threads
+	);
+
+/* all the components of the surface in the cubes |i|, |j|, |k| <= bounds
+   around in_ptCenter, the lattice swept slab by slab; batch evaluates
+   function at m points (3*m coordinates), gradient may be NULL.
+   continueproc, if given, is called before each block of BATCHBLOCK
+   evaluations; false aborts the polygonization (false returned) */
+bool polygonize_grid (
+    double (*function)(const R3Pt &in_pt),
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    void (*batch)(const double *in_pts, int m, double *out_values),
+    double size,
+	int bounds,
+    const R3Pt &in_ptCenter,
+	int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices),
+	int n_threads,
+	bool (*continueproc)()
+	);
+
+/* the surface in the cubes |i|, |j|, |k| <= bounds around in_ptCenter from
+   an octree refined near it, until the function is linear within tol*size
+   over each cube, then dual contoured (octree.cpp); batch evaluates the
+   function at m points (3*m coordinates), gradient is called concurrently.
+   With previews > 0, the octree is also contoured when its cubes of side
+   2^previews, ..., 2 times size are evaluated: triproc and vertproc are
+   called for these coarser surfaces first, each ended by vertproc; previews
+   must be at most the depth of the octree, ceil(log2(2*bounds+1)).
+   continueproc, if given, is called before each block of BATCHBLOCK corner
+   evaluations and by each task of the center evaluations; false aborts the
+   polygonization (false returned) */
+bool polygonize_octree (
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    void (*batch)(const double *in_pts, int m, double *out_values),
+    double size,
+	int bounds,
+    const R3Pt &in_ptCenter,
+    double tol,
+    int previews,
+	int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices),
+	int n_threads,
+	bool (*continueproc)()
+	);
+
 /* see implicit.c for explanation of arguments */
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif
+/* the surface crossing between in_p1 and in_p2 (values v1, v2 of differing
+   sign) by Newton steps, out_grad the gradient there */
+void converge_gradient ( const R3Pt &in_p1, const R3Pt &in_p2, double v1, double v2,
+                         double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+                         R3Pt &out_p, R3Vec &out_grad);
 
+#define BATCHBLOCK 65536 /* points a call of batch_checked */
 
+/* batch at the m points in blocks of BATCHBLOCK, continueproc (may be NULL)
+   called before each; false, with the rest of out_values unset, if it
+   returned false */
+bool batch_checked ( void (*batch)(const double *in_pts, int m, double *out_values),
+                     bool (*continueproc)(),
+                     const double *in_pts, size_t m, double *out_values);
 
+#endif
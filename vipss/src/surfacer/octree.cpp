@@ -0,0 +1,450 @@
+#include "Polygonizer.h"
+
+/**** An Adaptive Octree Polygonizer ****/
+
+/*
+ * The cubes of an octree are refined near the surface only: a cube is split
+ * if the surface may pass through it (a sign change at its corners, or a
+ * value small compared to the gradient at its center) and the function is
+ * not close enough to linear over it. The leaves are contoured by dual
+ * contouring (Ju et al., "Dual Contouring of Hermite Data", 2002): a vertex
+ * per leaf, from the crossings and gradients on its edges, and a quad per
+ * minimal edge with a sign change, joining the leaves around the edge. The
+ * mesh is closed (except where it leaves the octree) whatever the sizes of
+ * neighboring leaves.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include "../utility.h"
+
+#define OCTMIN    4        /* levels refined everywhere */
+#define OCTNEAR   2.0      /* near the surface: |f| < OCTNEAR*|grad f|*radius */
+#define OCTLAMBDA 0.05     /* QEF regularization, toward the mass point */
+#define OCTCHUNK  64       /* cubes per task */
+#define OCTBITS   19       /* bits per axis of a lattice key */
+#define OCTKEY(x,y,z) \
+((((uint64_t)(x)<<OCTBITS|(uint64_t)(y))<<OCTBITS)|(uint64_t)(z))
+#define BIT(i, bit) (((i)>>(bit))&1)
+
+/* the lattice of the finest cubes: corner (x, y, z), 0 <= x, y, z <= 2^depth,
+ * at origin + (x, y, z)*size; a cube of level l has side 2^(depth-l). The
+ * cubes out of the domain, x, y or z >= extent, are not evaluated, and the
+ * cubes across its bound are split as long as they may hold surface */
+
+typedef struct {                   /* octree cube */
+    int x, y, z;                   /* lattice location of the LBN corner */
+    int level;                     /* 0 for the root */
+    int child;                     /* first of the 8 children, -1 if leaf */
+    int vid;                       /* vertex id, -1 if none */
+    double value[8];               /* corner values, corner n at
+                                      (x+BIT(n,2), y+BIT(n,1), z+BIT(n,0))*side */
+} OCTCUBE;
+
+typedef struct {                   /* surface crossing of an edge */
+    R3Pt p;
+    R3Vec n;                       /* gradient at p */
+} OCTCROSS;
+
+typedef struct {
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad);
+    void (*batch)(const double *in_pts, int m, double *out_values);
+    bool (*continueproc)();
+    double size;
+    int depth, extent;
+    R3Pt origin;
+    std::vector<OCTCUBE> cubes;
+} OCTREE;
+
+
+/* octpoint: location of lattice point (x, y, z) */
+
+static R3Pt octpoint (const OCTREE *o, double x, double y, double z) {
+    return R3Pt(o->origin[0]+x*o->size, o->origin[1]+y*o->size, o->origin[2]+z*o->size);
+}
+
+
+/* octoutside: 1 if the cube is out of the domain, 2 if across its bound */
+
+static int octoutside (const OCTREE *o, const OCTCUBE *c) {
+    int side = 1 << (o->depth-c->level);
+    if (c->x >= o->extent || c->y >= o->extent || c->z >= o->extent) return 1;
+    if (c->x+side > o->extent || c->y+side > o->extent || c->z+side > o->extent) return 2;
+    return 0;
+}
+
+
+/* octerror: deviation of the function from linear over the cube: the
+ * largest residual of the least squares linear fit to the corner values, at
+ * the corners and at the center (value fc) */
+
+static double octerror (const OCTCUBE *c, double fc) {
+    double a = 0, gx = 0, gy = 0, gz = 0, err;
+    int n;
+    for (n = 0; n < 8; n++) {
+        a += c->value[n];
+        gx += BIT(n,2) ? c->value[n] : -c->value[n];
+        gy += BIT(n,1) ? c->value[n] : -c->value[n];
+        gz += BIT(n,0) ? c->value[n] : -c->value[n];
+    }
+    a /= 8; gx /= 8; gy /= 8; gz /= 8;
+    err = fabs(fc-a);
+    for (n = 0; n < 8; n++) {
+        double l = a + (BIT(n,2) ? gx : -gx) + (BIT(n,1) ? gy : -gy) + (BIT(n,0) ? gz : -gz);
+        err = std::max(err, fabs(c->value[n]-l));
+    }
+    return err;
+}
+
+
+/* octsign: 1 if the corner values of the cube differ in sign */
+
+static int octsign (const OCTCUBE *c) {
+    int n, npos = 0;
+    for (n = 0; n < 8; n++) npos += c->value[n] > 0.0;
+    return npos != 0 && npos != 8;
+}
+
+
+/* octbuild: refine the octree level by level; the corners new to a level
+ * are evaluated by batch (in blocks, see batch_checked), the centers (for the
+ * cubes not refined everywhere) with gradient on n_threads threads. levelproc,
+ * if given, is called with each level l < depth once its corner values are
+ * set (its cubes are leaves then); it returns false to stop, as continueproc
+ * does between the blocks of corners and the tasks of centers */
+
+static bool octbuild (OCTREE *o, double tol, int n_threads, const std::function<bool(int)> &levelproc) {
+    std::unordered_map<uint64_t, double> values;
+    std::vector<int> level(1, 0), next;
+    std::vector<uint64_t> keys;
+    std::vector<double> pts, vals;
+    std::vector<char> split;
+
+    OCTCUBE root;
+    root.x = root.y = root.z = root.level = 0;
+    root.child = root.vid = -1;
+    o->cubes.assign(1, root);
+
+    int l;
+    for (l = 0; !level.empty(); l++) {
+        int side = 1 << (o->depth-l), ncubes = (int)level.size();
+
+        /* corner values, new corners at once: */
+        keys.clear(); pts.clear();
+        for (int m = 0; m < ncubes; m++) {
+            const OCTCUBE &c = o->cubes[level[m]];
+            if (octoutside(o, &c) == 1) continue;
+            for (int n = 0; n < 8; n++) {
+                int x = c.x+BIT(n,2)*side, y = c.y+BIT(n,1)*side, z = c.z+BIT(n,0)*side;
+                uint64_t key = OCTKEY(x, y, z);
+                if (!values.emplace(key, 0.0).second) continue;
+                R3Pt pt = octpoint(o, x, y, z);
+                keys.push_back(key);
+                pts.push_back(pt[0]); pts.push_back(pt[1]); pts.push_back(pt[2]);
+            }
+        }
+        vals.resize(keys.size());
+        if (!batch_checked(o->batch, o->continueproc, pts.data(), keys.size(), vals.data())) return false;
+        for (size_t m = 0; m < keys.size(); m++) values[keys[m]] = vals[m];
+        for (int m = 0; m < ncubes; m++) {
+            OCTCUBE &c = o->cubes[level[m]];
+            if (octoutside(o, &c) == 1) continue;
+            for (int n = 0; n < 8; n++)
+                c.value[n] = values[OCTKEY(c.x+BIT(n,2)*side, c.y+BIT(n,1)*side, c.z+BIT(n,0)*side)];
+        }
+        if (l == o->depth) break;
+        if (levelproc && !levelproc(l)) return false;
+
+        /* which cubes to split: */
+        split.resize(ncubes);
+        for (int m = 0; m < ncubes; m++) split[m] = octoutside(o, &o->cubes[level[m]]) != 1;
+        std::atomic<bool> isstopped(false);
+        if (l >= OCTMIN)
+            MyUtility::parallelFor((ncubes+OCTCHUNK-1)/OCTCHUNK, n_threads, [&](int t, int) {
+                if (isstopped || (o->continueproc && !o->continueproc())) {
+                    isstopped = true;
+                    return;
+                }
+                int end = std::min(ncubes, (t+1)*OCTCHUNK);
+                for (int m = t*OCTCHUNK; m < end; m++) {
+                    const OCTCUBE &c = o->cubes[level[m]];
+                    if (!split[m]) continue;
+                    double h = 0.5*side;
+                    R3Vec g;
+                    double fc = o->gradient(octpoint(o, c.x+h, c.y+h, c.z+h), g);
+                    double gn = sqrt(g[0]*g[0]+g[1]*g[1]+g[2]*g[2]);
+                    double radius = sqrt(3.0)*h*o->size;
+                    if (octsign(&c)) split[m] = octoutside(o, &c) || gn <= 0 || octerror(&c, fc) > tol*gn;
+                    else split[m] = fabs(fc) < OCTNEAR*gn*radius &&  /* may pass inside */
+                                    (octoutside(o, &c) || gn <= 0 || octerror(&c, fc) > tol*gn);
+                }
+            });
+        if (isstopped) return false;
+
+        next.clear();
+        for (int m = 0; m < ncubes; m++) {
+            if (!split[m]) continue;
+            OCTCUBE c = o->cubes[level[m]];
+            o->cubes[level[m]].child = (int)o->cubes.size();
+            for (int n = 0; n < 8; n++) {
+                OCTCUBE s;
+                s.x = c.x+BIT(n,2)*side/2; s.y = c.y+BIT(n,1)*side/2; s.z = c.z+BIT(n,0)*side/2;
+                s.level = l+1;
+                s.child = s.vid = -1;
+                next.push_back((int)o->cubes.size());
+                o->cubes.push_back(s);
+            }
+        }
+        level.swap(next);
+    }
+    for (; l < o->depth; l++)               /* no cube left to split */
+        if (levelproc && !levelproc(l)) return false;
+
+    return true;
+}
+
+
+/* octlocate: the leaf containing the point (X, Y, Z) of the lattice of half
+ * the size (coordinates doubled), which is not on a face of it; -1 if the
+ * point is out of the domain */
+
+static int octlocate (const OCTREE *o, int X, int Y, int Z) {
+    int n = 2*o->extent;
+    if (X <= 0 || Y <= 0 || Z <= 0 || X >= n || Y >= n || Z >= n) return -1;
+    int c = 0;
+    while (o->cubes[c].child != -1) {
+        const OCTCUBE &q = o->cubes[c];
+        int side = 1 << (o->depth-q.level);
+        c = q.child + ((X > 2*q.x+side) << 2) + ((Y > 2*q.y+side) << 1) + (Z > 2*q.z+side);
+    }
+    return c;
+}
+
+
+/* edge n of a cube, from corner edgecorner[n] along axis edgeaxis[n]
+ * (0: x, bit 2 of the corner; 1: y, bit 1; 2: z, bit 0) */
+
+static const int edgecorner[12] = {0,1,2,3, 0,1,4,5, 0,2,4,6};
+static const int edgeaxis[12]   = {0,0,0,0, 1,1,1,1, 2,2,2,2};
+
+
+/* octedgekey: key of an edge of a cube of level l */
+
+static uint64_t octedgekey (const OCTREE *o, const OCTCUBE &c, int e) {
+    int side = 1 << (o->depth-c.level), n = edgecorner[e];
+    uint64_t key = OCTKEY(c.x+BIT(n,2)*side, c.y+BIT(n,1)*side, c.z+BIT(n,0)*side);
+    return (key << 2 | edgeaxis[e]) << 5 | c.level;
+}
+
+
+/* octvertex: vertex of a leaf, the minimizer of the QEF of the crossings on
+ * its edges (regularized toward their mass point, which is used if the
+ * minimizer is out of the cube); without crossings, the center moved to the
+ * surface by a Newton step */
+
+static void octvertex (const OCTREE *o, const OCTCUBE &c, const OCTCROSS *const *cross, int ncross,
+                       VERTEX &v) {
+    double side = (double)(1 << (o->depth-c.level));
+    R3Pt lo = octpoint(o, c.x, c.y, c.z);
+    double w = side*o->size;
+    if (ncross == 0) {
+        R3Vec g;
+        R3Pt ct = octpoint(o, c.x+0.5*side, c.y+0.5*side, c.z+0.5*side);
+        double f = o->gradient(ct, g), gg = g[0]*g[0]+g[1]*g[1]+g[2]*g[2];
+        for (int k = 0; k < 3; k++) {
+            double x = gg > 0 ? ct[k]-f*g[k]/gg : ct[k];
+            v.position[k] = std::min(std::max(x, lo[k]), lo[k]+w);
+        }
+        v.normal = UnitSafe(g);
+        return;
+    }
+
+    double A[3][3] = {{0,0,0},{0,0,0},{0,0,0}}, b[3] = {0,0,0}, m[3] = {0,0,0};
+    R3Vec nsum(0,0,0);
+    for (int i = 0; i < ncross; i++)
+        for (int k = 0; k < 3; k++) m[k] += cross[i]->p[k]/ncross;
+    for (int i = 0; i < ncross; i++) {
+        R3Vec n = UnitSafe(cross[i]->n);
+        double d = 0;
+        for (int k = 0; k < 3; k++) d += n[k]*(cross[i]->p[k]-m[k]);
+        for (int k = 0; k < 3; k++) {
+            for (int l = 0; l < 3; l++) A[k][l] += n[k]*n[l];
+            b[k] += n[k]*d;
+        }
+        nsum += n;
+    }
+    for (int k = 0; k < 3; k++) A[k][k] += OCTLAMBDA*ncross;
+
+    /* (A + lambda I) x = b by Cramer's rule, x the offset from m: */
+    double det = A[0][0]*(A[1][1]*A[2][2]-A[1][2]*A[2][1])
+               - A[0][1]*(A[1][0]*A[2][2]-A[1][2]*A[2][0])
+               + A[0][2]*(A[1][0]*A[2][1]-A[1][1]*A[2][0]);
+    double x[3];
+    for (int k = 0; k < 3; k++) {
+        double B[3][3];
+        for (int r = 0; r < 3; r++)
+            for (int s = 0; s < 3; s++) B[r][s] = s == k ? b[r] : A[r][s];
+        x[k] = (B[0][0]*(B[1][1]*B[2][2]-B[1][2]*B[2][1])
+              - B[0][1]*(B[1][0]*B[2][2]-B[1][2]*B[2][0])
+              + B[0][2]*(B[1][0]*B[2][1]-B[1][1]*B[2][0])) / det;
+    }
+    bool inside = true;
+    for (int k = 0; k < 3; k++) {
+        x[k] += m[k];
+        inside = inside && x[k] >= lo[k] && x[k] <= lo[k]+w;
+    }
+    for (int k = 0; k < 3; k++) v.position[k] = inside ? x[k] : m[k];
+    v.normal = UnitSafe(nsum);
+}
+
+
+/* octcontour: dual contour the leaves of the octree (as built so far) */
+
+static bool octcontour (OCTREE *o, int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+                        void (*vertproc)(VERTICES vertices), int n_threads) {
+    /* quads of the minimal edges with a sign change, as the leaves around
+     * them in turn, with the vertices numbered in order of use: */
+    std::unordered_set<uint64_t> done;
+    std::vector<int> quads, leaves;
+    for (int c = 0; c < (int)o->cubes.size(); c++) {
+        const OCTCUBE &q = o->cubes[c];
+        if (q.child != -1 || octoutside(o, &q) == 1 || !octsign(&q)) continue;
+        int side = 1 << (o->depth-q.level);
+        for (int e = 0; e < 12; e++) {
+            int n0 = edgecorner[e], a = edgeaxis[e];
+            int n1 = n0 | (4 >> a);
+            if ((q.value[n0] > 0.0) == (q.value[n1] > 0.0)) continue;
+            if (!done.insert(octedgekey(o, q, e)).second) continue;
+            int P[3] = {2*(q.x+BIT(n0,2)*side), 2*(q.y+BIT(n0,1)*side), 2*(q.z+BIT(n0,0)*side)};
+            int b = (a+1)%3, d = (a+2)%3, L[4];
+            static const int around[4][2] = {{-1,-1},{1,-1},{1,1},{-1,1}};
+            bool minimal = true;
+            for (int k = 0; k < 4 && minimal; k++) {
+                int X[3];
+                X[a] = P[a]+side; X[b] = P[b]+around[k][0]; X[d] = P[d]+around[k][1];
+                L[k] = octlocate(o, X[0], X[1], X[2]);
+                minimal = L[k] != -1 && o->cubes[L[k]].level <= q.level;
+            }
+            if (!minimal) continue;
+            if (q.value[n0] <= 0.0) std::swap(L[1], L[3]);
+            for (int k = 0; k < 4; k++) {
+                OCTCUBE &r = o->cubes[L[k]];
+                if (r.vid == -1) {r.vid = (int)leaves.size(); leaves.push_back(L[k]);}
+                quads.push_back(r.vid);
+            }
+        }
+    }
+
+    /* crossings of the edges of the leaves with a vertex, each edge once: */
+    std::unordered_map<uint64_t, int> edgeid;
+    std::vector<int> edgecube, edgeno, first(leaves.size()+1, 0), crossid;
+    for (size_t v = 0; v < leaves.size(); v++) {
+        const OCTCUBE &q = o->cubes[leaves[v]];
+        for (int e = 0; e < 12; e++) {
+            int n0 = edgecorner[e], n1 = n0 | (4 >> edgeaxis[e]);
+            if ((q.value[n0] > 0.0) == (q.value[n1] > 0.0)) continue;
+            auto it = edgeid.emplace(octedgekey(o, q, e), (int)edgecube.size());
+            if (it.second) {edgecube.push_back(leaves[v]); edgeno.push_back(e);}
+            crossid.push_back(it.first->second);
+        }
+        first[v+1] = (int)crossid.size();
+    }
+    std::vector<OCTCROSS> cross(edgecube.size());
+    int ncross = (int)cross.size();
+    MyUtility::parallelFor((ncross+OCTCHUNK-1)/OCTCHUNK, n_threads, [&](int t, int) {
+        int end = std::min(ncross, (t+1)*OCTCHUNK);
+        for (int i = t*OCTCHUNK; i < end; i++) {
+            const OCTCUBE &q = o->cubes[edgecube[i]];
+            int side = 1 << (o->depth-q.level), e = edgeno[i];
+            int n0 = edgecorner[e], n1 = n0 | (4 >> edgeaxis[e]);
+            R3Pt p0 = octpoint(o, q.x+BIT(n0,2)*side, q.y+BIT(n0,1)*side, q.z+BIT(n0,0)*side);
+            R3Pt p1 = octpoint(o, q.x+BIT(n1,2)*side, q.y+BIT(n1,1)*side, q.z+BIT(n1,0)*side);
+            converge_gradient(p0, p1, q.value[n0], q.value[n1], o->gradient, cross[i].p, cross[i].n);
+        }
+    });
+
+    /* vertices: */
+    std::vector<VERTEX> vertices(leaves.size());
+    int nleaves = (int)leaves.size();
+    MyUtility::parallelFor((nleaves+OCTCHUNK-1)/OCTCHUNK, n_threads, [&](int t, int) {
+        int end = std::min(nleaves, (t+1)*OCTCHUNK);
+        std::vector<const OCTCROSS *> cs;
+        for (int v = t*OCTCHUNK; v < end; v++) {
+            cs.clear();
+            for (int i = first[v]; i < first[v+1]; i++) cs.push_back(&cross[crossid[i]]);
+            octvertex(o, o->cubes[leaves[v]], cs.data(), (int)cs.size(), vertices[v]);
+        }
+    });
+
+    /* triangles, two a quad (one if two leaves around the edge are the same): */
+    VERTICES vs;
+    vs.count = vs.max = (int)vertices.size();
+    vs.ptr = vertices.data();
+    for (size_t m = 0; m < quads.size(); m += 4) {
+        int ids[4], k = 0;
+        for (int i = 0; i < 4; i++) {
+            int id = quads[m+i];
+            if (k > 0 && ids[k-1] == id) continue;
+            if (i == 3 && ids[0] == id) continue;
+            ids[k++] = id;
+        }
+        if (k < 3) continue;
+        if (!triproc(ids[0], ids[1], ids[2], vs) ||
+            (k == 4 && !triproc(ids[0], ids[2], ids[3], vs))) {
+            cerr << "ERR: polyganizeraborted";
+            return false;
+        }
+    }
+    vertproc(vs);
+
+    for (size_t v = 0; v < leaves.size(); v++) o->cubes[leaves[v]].vid = -1;
+    return true;
+}
+
+
+/* polygonize_octree: see Polygonizer.h */
+
+bool polygonize_octree (
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    void (*batch)(const double *in_pts, int m, double *out_values),
+    double size,
+    int bounds,
+    const R3Pt &in_ptCenter,
+    double tol,
+    int previews,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices),
+    int n_threads,
+    bool (*continueproc)())
+    {
+    OCTREE o;
+    o.gradient = gradient;
+    o.batch = batch;
+    o.continueproc = continueproc;
+    o.size = size;
+    for (o.depth = 0; (1 << o.depth) < 2*bounds+1; o.depth++);
+    if (o.depth > OCTBITS-1) {
+        cerr << "ERR: octree too deep\n";
+        return false;
+    }
+    o.extent = 2*bounds+1;
+    double half = (bounds+0.5)*size;
+    o.origin = R3Pt(in_ptCenter[0]-half, in_ptCenter[1]-half, in_ptCenter[2]-half);
+
+    /* the previews, contoured as the cubes of their level are evaluated: */
+    int first = o.depth-std::max(previews, 0);
+    if (!octbuild(&o, tol*size, n_threads, [&](int l) {
+            return l < first || octcontour(&o, triproc, vertproc, n_threads);
+        })) {
+        cerr << "ERR: polyganizeraborted";
+        return false;
+    }
+
+    return octcontour(&o, triproc, vertproc, n_threads);
+}
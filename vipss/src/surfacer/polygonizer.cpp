@@ -43,8 +43,14 @@
 #endif
 #include <stdio.h>
 #include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include "../utility.h"
 
 #define RES     10 /* # converge iterations    */
+#define NEWTON_TOL 1e-5 /* converge_gradient step tolerance, in edge lengths */
 
 #define L       0  /* left direction:   -x, -i */
 #define R       1  /* right direction:  +x, +i */
@@ -65,13 +71,17 @@
  * (start.x+(i-.5)*size, start.y+(j-.5)*size, start.z+(k-.5)*size) */
 
 #define RAND()    ((rand()&32767)/32767.)  /* random number, 0--1 */
-#define HASHBIT   (5)
-#define HSIZE     (size_t)(1<<(3*HASHBIT)) /* hash table size (32768) */
-#define MASK      ((1<<HASHBIT)-1)
-#define HASH(i,j,k) \
-((((((i)&MASK)<<HASHBIT)|((j)&MASK))<<HASHBIT)|((k)&MASK))
+#define KEYBITS   19       /* bits per axis of a lattice key */
+#define KEYOFF    (1<<(KEYBITS-1))
+#define KEY(i,j,k) \
+((((uint64_t)((i)+KEYOFF)<<KEYBITS|(uint64_t)((j)+KEYOFF))<<KEYBITS)|(uint64_t)((k)+KEYOFF))
+#define SHARDBITS 8        /* a table is 1<<SHARDBITS shards, each with a lock */
+#define NSHARD    (1<<SHARDBITS)
+#define SHARDSIZE 64       /* initial slots of a shard */
+#define ARENASIZE 16384    /* bytes of an arena block */
 #define BIT(i, bit) (((i)>>(bit))&1)
 #define FLIP(i,bit) ((i)^1<<(bit)) /* flip the given bit of i */
+#define CHUNK     16       /* cubes per task of followfronts */
 
 double RNEpsilon_d = 1e-15;
 float RNEpsilon_f = 1e-6;
@@ -83,10 +93,9 @@ typedef struct {                   /* test the function for a signed value */
     int ok;                        /* if value is of correct sign */
 } TEST;
 
-typedef struct cornerlist {        /* list of corners */
+typedef struct cornerlist {        /* corner, entry of the corner table */
     int i, j, k;                   /* corner id */
     double value;                   /* corner value */
-    struct cornerlist *next;       /* remaining elements */
 } CORNERLIST;
 
 typedef struct {                   /* partitioning cell (cube) */
@@ -99,17 +108,30 @@ typedef struct cubes {             /* linked list (stack) of cubes */
     struct cubes *next;            /* remaining elements */
 } CUBES;
 
-typedef struct centerlist {        /* list of cube locations */
-    int i, j, k;                   /* cube location */
-    struct centerlist *next;       /* remaining elements */
-} CENTERLIST;
-
-typedef struct edgelist {          /* list of edges */
-    int i1, j1, k1, i2, j2, k2;    /* edge corner ids */
-    int vid;                       /* vertex id */
-    struct edgelist *next;         /* remaining elements */
+typedef struct edgelist {          /* edge, entry of the edge table */
+    int vid;                       /* vertex id, -1 until numbered */
+    VERTEX vertex;                 /* vertex on the edge */
 } EDGELIST;
 
+typedef struct {                   /* bump allocator, freed at once */
+    char *ptr, *end;               /* free space of the current block */
+    char *blocks;                  /* blocks, linked by their first word */
+} ARENA;
+
+typedef struct {                   /* open-addressing hash table part */
+    uint64_t *keys;                /* packed keys, 0 for an empty slot */
+    void **items;                  /* entries of the keys */
+    size_t mask, count;            /* # slots - 1, # keys */
+    ARENA arena;                   /* storage of the entries */
+} SHARD;
+
+typedef struct {                   /* hash table of lattice keys, split in
+                                      shards by the high bits of the hash */
+    SHARD shards[NSHARD];
+    std::mutex *locks;             /* NSHARD locks if shared by threads,
+                                      or NULL */
+} TABLE;
+
 typedef struct intlist {           /* list of integers */
     int i;                         /* an integer */
     struct intlist *next;          /* remaining elements */
@@ -123,6 +145,9 @@ typedef struct intlists {          /* list of list of integers */
 typedef struct process {           /* parameters, function, storage */
     double (*function)
       (const R3Pt &in_pt);         /* implicit surface function */
+    double (*gradient)
+      (const R3Pt &in_pt,
+       R3Vec &out_grad);           /* value and gradient, or NULL */
     int (*triproc)(int i1, int i2,
       int i3, VERTICES vertices);  /* triangle output function */
     double size, delta;             /* cube size, normal delta */
@@ -130,9 +155,9 @@ typedef struct process {           /* parameters, function, storage */
     R3Pt start;                   /* start point on surface */
     CUBES *cubes;                  /* active cubes */
     VERTICES vertices;             /* surface vertices */
-    CENTERLIST **centers;          /* cube center hash table */
-    CORNERLIST **corners;          /* corner value hash table */
-    EDGELIST **edges;              /* edge and vertex id hash table */
+    TABLE *centers;                /* cube center hash table */
+    TABLE *corners;                /* corner value hash table */
+    TABLE *edges;                  /* edge and vertex id hash table */
 } PROCESS;
 
 
@@ -140,18 +165,45 @@ void freeprocess (PROCESS *p);
 
 int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p);
 
-int setcenter(CENTERLIST *table[], int i, int j, int k);
+template <class Vert, class Tri>
+static int tetcases (CORNERLIST *a, CORNERLIST *b, CORNERLIST *c, CORNERLIST *d,
+                     Vert vert, Tri tri);
+
+int dotet_parallel (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p,
+                    std::vector<EDGELIST *> &out_tris);
+
+int setcenter(TABLE *table, int i, int j, int k);
+int getcenter(TABLE *table, int i, int j, int k);
 
 int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p);
 
+EDGELIST *setedge (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p);
+
+int addtovertices (VERTICES *vertices, VERTEX v);
+
 
 char *mycalloc (int nitems, int nbytes);
+TABLE *newtable (std::mutex *locks);
+void freetable (TABLE *table);
+char *arenaalloc (ARENA *arena, int nbytes);
+uint64_t mixkey (uint64_t key);
+uint64_t edgekey (int i1, int j1, int k1, int i2, int j2, int k2);
+SHARD *getshard (TABLE *table, uint64_t h);
+std::unique_lock<std::mutex> lockshard (TABLE *table, uint64_t h);
+void **tableitem (TABLE *table, uint64_t key, uint64_t h);
+void **findtableitem (TABLE *table, uint64_t key, uint64_t h);
 CORNERLIST *setcorner (PROCESS *p, int i, int j, int k);
+void setpoint (R3Pt &out_pt, int i, int j, int k, PROCESS *p);
+void edgevertex (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p, VERTEX &v);
 
 void converge ( const R3Pt &in_p1, const R3Pt &p2, double v,
                 double (*function)(const R3Pt &in_pt),
                 R3Pt &p);
 
+void converge_gradient ( const R3Pt &in_p1, const R3Pt &in_p2, double v1, double v2,
+                         double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+                         R3Pt &out_p, R3Vec &out_grad);
+
 TEST find (int sign, PROCESS *p, const R3Pt &in_pt);
 
 
@@ -441,7 +493,9 @@ void testface ( int i, int j, int k,
 
                 CUBE *old,
 
-                int face, int c1, int c2, int c3, int c4,   PROCESS *p);
+                int face, int c1, int c2, int c3, int c4,   PROCESS *p,
+
+                std::vector<CUBE> *out = NULL);
 
 
 /* polygonize: polygonize the implicit surface function
@@ -477,20 +531,38 @@ bool polygonize (
     int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
 	void (*vertproc)(VERTICES vertices))
     {
+    return polygonize_gradient(function, NULL, size, bounds, in_pt, triproc, vertproc);
+}
+
+/* polygonize_gradient: as polygonize; when gradient is not NULL the edge
+ * crossings are found by safeguarded Newton iterations (converge_gradient)
+ * and the vertex normals are the normalized gradients at the crossings */
+
+bool polygonize_gradient (
+    double (*function)(const R3Pt &in_pt),
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    double size,
+    int bounds,
+    const R3Pt &in_pt,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices))
+    {
     int n;
     PROCESS p;
     TEST in, out;
     
     p.function = function;
+    p.gradient = gradient;
     p.triproc = triproc;
     p.size = size;
     p.bounds = bounds;
     p.delta = size/(double)(RES*RES);
+    if (p.bounds > KEYOFF-2) p.bounds = KEYOFF-2; /* lattice keys */
 
     /* allocate hash tables: */
-    p.centers = (CENTERLIST **) mycalloc(HSIZE, sizeof(CENTERLIST *));
-    p.corners = (CORNERLIST **) mycalloc(HSIZE,   sizeof(CORNERLIST *));
-    p.edges   = (EDGELIST   **) mycalloc(2*HSIZE, sizeof(EDGELIST *));
+    p.centers = newtable(NULL);
+    p.corners = newtable(NULL);
+    p.edges   = newtable(NULL);
 
     p.vertices.count = p.vertices.max = 0; /* no vertices yet */
     p.vertices.ptr = NULL;
@@ -560,44 +632,320 @@ bool polygonize (
     return NULL;
 }
 
-/* freeprocess: free all allocated memory */
-
-void freeprocess (PROCESS *p) {
-    int index;
-    CORNERLIST *l, *lnext;
-    CENTERLIST *cl, *clnext;
-    EDGELIST *edge, *edgenext;
-
-    for (index = 0; index < HSIZE; index++)
-        for (l = p->corners[index]; l; l = lnext) {
-            lnext = l->next;
-            free((char *) l);           /* free CORNERLIST */
+/* followfronts: follow the surface from the cubes of front (whose centers
+ * are set) with n_threads threads, front by front: the cubes of a front are
+ * triangulated and their neighbors found in parallel, then the triangles are
+ * output and their new vertices numbered in cube order, and the next front is
+ * sorted by lattice location. Returns false if triproc aborted */
+
+static bool followfronts (PROCESS *p, std::vector<CUBE> &front, int n_threads) {
+    std::vector<CUBE> next;
+    std::vector< std::vector<CUBE> > found(std::max(n_threads, 1));
+    std::vector< std::vector<EDGELIST *> > tris;
+
+    while (!front.empty()) {
+        int ncubes = front.size(), ntasks = (ncubes+CHUNK-1)/CHUNK;
+        tris.assign(ntasks, std::vector<EDGELIST *>());
+
+        /* triangulate the front and find the next one, CHUNK cubes a task: */
+        MyUtility::parallelFor(ntasks, n_threads, [&](int t, int tid) {
+            int end = std::min(ncubes, (t+1)*CHUNK);
+            for (int m = t*CHUNK; m < end; m++) {
+                CUBE *c = &front[m];
+                dotet_parallel(c, LBN, LTN, RBN, LBF, p, tris[t]);
+                dotet_parallel(c, RTN, LTN, LBF, RBN, p, tris[t]);
+                dotet_parallel(c, RTN, LTN, LTF, LBF, p, tris[t]);
+                dotet_parallel(c, RTN, RBN, LBF, RBF, p, tris[t]);
+                dotet_parallel(c, RTN, LBF, LTF, RBF, p, tris[t]);
+                dotet_parallel(c, RTN, LTF, RTF, RBF, p, tris[t]);
+
+                testface(c->i-1, c->j, c->k, c, L, LBN, LBF, LTN, LTF, p, &found[tid]);
+                testface(c->i+1, c->j, c->k, c, R, RBN, RBF, RTN, RTF, p, &found[tid]);
+                testface(c->i, c->j-1, c->k, c, B, LBN, LBF, RBN, RBF, p, &found[tid]);
+                testface(c->i, c->j+1, c->k, c, T, LTN, LTF, RTN, RTF, p, &found[tid]);
+                testface(c->i, c->j, c->k-1, c, N, LBN, LTN, RBN, RTN, p, &found[tid]);
+                testface(c->i, c->j, c->k+1, c, F, LBF, LTF, RBF, RTF, p, &found[tid]);
+            }
+        });
+
+        /* number the new vertices and output the triangles, in cube order: */
+        for (int t = 0; t < ntasks; t++)
+            for (size_t m = 0; m < tris[t].size(); m += 3) {
+                int ids[3];
+                for (int l = 0; l < 3; l++) {
+                    EDGELIST *e = tris[t][m+l];
+                    if (e->vid == -1) e->vid = addtovertices(&p->vertices, e->vertex);
+                    ids[l] = e->vid;
+                }
+                if (!p->triproc(ids[0], ids[1], ids[2], p->vertices)) return false;
+            }
+
+        /* next front, in lattice order: */
+        next.clear();
+        for (size_t l = 0; l < found.size(); l++) {
+            next.insert(next.end(), found[l].begin(), found[l].end());
+            found[l].clear();
         }
-    for (index = 0; index < HSIZE; index++)
-        for (cl = p->centers[index]; cl; cl = clnext) {
-            clnext = cl->next;
-            free((char *) cl);          /* free CENTERLIST */
+        std::sort(next.begin(), next.end(), [](const CUBE &a, const CUBE &b) {
+            if (a.i != b.i) return a.i < b.i;
+            if (a.j != b.j) return a.j < b.j;
+            return a.k < b.k;
+        });
+        front.swap(next);
+    }
+
+    return true;
+}
+
+/* polygonize_seeded: as polygonize_gradient, with n_threads threads, the
+ * surface followed from points on it (e.g. the input points of a fit)
+ * instead of a point found by random search, the corner (i, j, k) at
+ * in_ptCenter + (i-.5, j-.5, k-.5)*size. For each seed in turn, if its cube
+ * was visited the seed's component is done, otherwise the seed's cube and
+ * its 26 neighbors that were not visited are tested, and the surface is
+ * followed from the first one with a sign change at its corners. A
+ * component is thus missed only if it passes through no unvisited cube
+ * among these 27 (it shares all of them with components already output).
+ * The surface is followed front by front (followfronts), the threads
+ * sharing the center, corner and edge tables, whose shards are locked (not
+ * by a single thread); the output is the same for any number of threads.
+ * Every component within bounds that holds a seed is output once, and seeds
+ * on a component already output cost (almost) no function evaluation */
+
+bool polygonize_seeded (
+    double (*function)(const R3Pt &in_pt),
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    double size,
+    int bounds,
+    const R3Pt &in_ptCenter,
+    const double *seeds,
+    int nseeds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices),
+    int n_threads)
+    {
+    PROCESS p;
+    std::vector<std::mutex> locks(n_threads > 1 ? 3*NSHARD : 0);
+
+    p.function = function;
+    p.gradient = gradient;
+    p.triproc = triproc;
+    p.size = size;
+    p.bounds = bounds;
+    p.delta = size/(double)(RES*RES);
+    p.start = in_ptCenter;
+    if (p.bounds > KEYOFF-2) p.bounds = KEYOFF-2; /* lattice keys */
+
+    /* allocate hash tables, shared by the threads: */
+    p.centers = newtable(n_threads > 1 ? &locks[0] : NULL);
+    p.corners = newtable(n_threads > 1 ? &locks[NSHARD] : NULL);
+    p.edges   = newtable(n_threads > 1 ? &locks[2*NSHARD] : NULL);
+
+    p.vertices.count = p.vertices.max = 0; /* no vertices yet */
+    p.vertices.ptr = NULL;
+
+    std::vector<CUBE> front(1);
+    int nfronts = 0;
+    for (int s = 0; s < nseeds; s++) {
+        const double *x = seeds+3*s;
+        int ci = (int)floor((x[0]-p.start[0])/size+0.5);
+        int cj = (int)floor((x[1]-p.start[1])/size+0.5);
+        int ck = (int)floor((x[2]-p.start[2])/size+0.5);
+        for (int n = 0; n < 27; n++) {      /* the seed's cube first */
+            static const int off[3] = {0, -1, 1};
+            int i = ci+off[n/9], j = cj+off[n/3%3], k = ck+off[n%3];
+            if (abs(i) > p.bounds || abs(j) > p.bounds || abs(k) > p.bounds) continue;
+            if (getcenter(p.centers, i, j, k)) {
+                if (n == 0) break;          /* on a component already output */
+                continue;
+            }
+
+            CUBE &c = front[0];
+            int npos = 0;
+            c.i = i; c.j = j; c.k = k;
+            for (int l = 0; l < 8; l++) {
+                c.corners[l] = setcorner(&p, i+BIT(l,2), j+BIT(l,1), k+BIT(l,0));
+                npos += c.corners[l]->value > 0.0;
+            }
+            if (npos == 0 || npos == 8) continue;
+
+            setcenter(p.centers, i, j, k);
+            nfronts++;
+            if (!followfronts(&p, front, n_threads)) {
+                freeprocess(&p);
+                cerr << "ERR: polyganizeraborted";
+                return false;
+            }
+            front.resize(1);
+            break;
         }
-    for (index = 0; index < 2*HSIZE; index++)
-        for (edge = p->edges[index]; edge; edge = edgenext) {
-            edgenext = edge->next;
-            free((char *) edge);        /* free EDGELIST */
+    }
+    cout << "surface followed from " << nfronts << " of " << nseeds << " seeds" << endl;
+
+    vertproc(p.vertices);
+    freeprocess(&p);
+
+    return true;
+}
+
+/* polygonize_grid: polygonize all the components of the surface within the
+ * cubes (i, j, k), |i|, |j|, |k| <= bounds, the corner (i, j, k) at
+ * in_ptCenter + (i-.5, j-.5, k-.5)*size. The lattice is swept in slabs of
+ * constant k: the corners of a slab are evaluated at once by batch, and only
+ * two slabs of values are kept. The cubes are split into tetrahedra as by
+ * polygonize, and the vertex of an edge is shared by all its cubes through
+ * the vertex ids of the edges in the two planes (and between them). The new
+ * vertices of a layer of cubes are found with function or gradient on
+ * n_threads threads; the output does not depend on n_threads */
+
+bool polygonize_grid (
+    double (*function)(const R3Pt &in_pt),
+    double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+    void (*batch)(const double *in_pts, int m, double *out_values),
+    double size,
+    int bounds,
+    const R3Pt &in_ptCenter,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+	void (*vertproc)(VERTICES vertices),
+    int n_threads,
+    bool (*continueproc)())
+    {
+    PROCESS p;                            /* for setpoint and edgevertex */
+    p.function = function;
+    p.gradient = gradient;
+    p.triproc = triproc;
+    p.size = size;
+    p.bounds = bounds;
+    p.delta = size/(double)(RES*RES);
+    p.start = in_ptCenter;
+
+    const int nc = 2*bounds+2;            /* corners per axis */
+    const size_t ns = (size_t)nc*nc;      /* corners per slab */
+    std::vector<double> pts(3*ns), lo(ns), hi(ns);
+    /* vertex ids of the edges in planes k and k+1, by lesser corner (in
+     * k, j, i order) and direction: +i, and +j with -i, 0, +i; and of the
+     * edges between the planes, by direction (-1..1, -1..1, +1) */
+    std::vector<int> planelo(4*ns, -1), planehi(4*ns), cross(9*ns);
+    std::vector<VERTEX> vertices;
+    std::vector<CORNERLIST> ends;         /* corners of the new edges */
+    std::vector<int> tris;
+
+    /* corner values of slab k, in j, i order: */
+    auto evalslab = [&](int k, std::vector<double> &out) {
+        R3Pt pt;
+        for (int j = 0; j < nc; j++)
+            for (int i = 0; i < nc; i++) {
+                setpoint(pt, i-bounds, j-bounds, k, &p);
+                double *q = &pts[3*(j*(size_t)nc+i)];
+                q[0] = pt[0]; q[1] = pt[1]; q[2] = pt[2];
+            }
+        return batch_checked(batch, continueproc, pts.data(), ns, out.data());
+    };
+
+    if (!evalslab(-bounds, lo)) {
+        cerr << "ERR: polyganizeraborted";
+        return false;
+    }
+    for (int k = -bounds; k <= bounds; k++) {
+        if (!evalslab(k+1, hi)) {
+            cerr << "ERR: polyganizeraborted";
+            return false;
         }
-    free((char *) p->edges);            /* free array EDGELIST ptrs */
-    free((char *) p->corners);          /* free array CORNERLIST ptrs */
-    free((char *) p->centers);          /* free array CENTERLIST ptrs */
+        std::fill(planehi.begin(), planehi.end(), -1);
+        std::fill(cross.begin(), cross.end(), -1);
+        size_t first = vertices.size();
+        ends.clear();
+        tris.clear();
+
+        auto vert = [&](CORNERLIST *a, CORNERLIST *b) {
+            if (a->k > b->k || (a->k == b->k && (a->j > b->j ||
+                (a->j == b->j && a->i > b->i)))) std::swap(a, b);
+            int di = b->i-a->i, dj = b->j-a->j;
+            size_t c = (size_t)(a->j+bounds)*nc + (a->i+bounds);
+            int *id;
+            if (a->k != b->k) id = &cross[9*c + (dj+1)*3 + (di+1)];
+            else id = &(a->k == k ? planelo : planehi)[4*c + (dj == 0 ? 0 : 2+di)];
+            if (*id == -1) {
+                *id = (int)vertices.size();
+                vertices.push_back(VERTEX());
+                ends.push_back(*a);
+                ends.push_back(*b);
+            }
+            return *id;
+        };
+        auto tri = [&](int i1, int i2, int i3) {
+            tris.push_back(i1); tris.push_back(i2); tris.push_back(i3);
+            return 1;
+        };
+
+        /* triangulate the layer of cubes between slabs k and k+1: */
+        for (int j = -bounds; j <= bounds; j++)
+            for (int i = -bounds; i <= bounds; i++) {
+                CORNERLIST c[8];
+                int n, npos = 0;
+                for (n = 0; n < 8; n++) {
+                    c[n].i = i+BIT(n,2); c[n].j = j+BIT(n,1); c[n].k = k+BIT(n,0);
+                    c[n].value = (BIT(n,0) ? hi : lo)
+                        [(size_t)(c[n].j+bounds)*nc + (c[n].i+bounds)];
+                    npos += c[n].value > 0.0;
+                }
+                if (npos == 0 || npos == 8) continue;
+                tetcases(c+LBN, c+LTN, c+RBN, c+LBF, vert, tri);
+                tetcases(c+RTN, c+LTN, c+LBF, c+RBN, vert, tri);
+                tetcases(c+RTN, c+LTN, c+LTF, c+LBF, vert, tri);
+                tetcases(c+RTN, c+RBN, c+LBF, c+RBF, vert, tri);
+                tetcases(c+RTN, c+LBF, c+LTF, c+RBF, vert, tri);
+                tetcases(c+RTN, c+LTF, c+RTF, c+RBF, vert, tri);
+            }
+
+        /* find the new vertices, CHUNK a task: */
+        int nnew = (int)(vertices.size()-first);
+        MyUtility::parallelFor((nnew+CHUNK-1)/CHUNK, n_threads, [&](int t, int) {
+            int end = std::min(nnew, (t+1)*CHUNK);
+            for (int m = t*CHUNK; m < end; m++)
+                edgevertex(&ends[2*m], &ends[2*m+1], &p, vertices[first+m]);
+        });
+
+        VERTICES vs;
+        vs.count = vs.max = (int)vertices.size();
+        vs.ptr = vertices.data();
+        for (size_t m = 0; m < tris.size(); m += 3)
+            if (!p.triproc(tris[m], tris[m+1], tris[m+2], vs)) {
+                cerr << "ERR: polyganizeraborted";
+                return false;
+            }
+
+        lo.swap(hi);
+        planelo.swap(planehi);
+    }
+
+    VERTICES vs;
+    vs.count = vs.max = (int)vertices.size();
+    vs.ptr = vertices.data();
+    vertproc(vs);
+
+    return true;
+}
+
+/* freeprocess: free all allocated memory */
+
+void freeprocess (PROCESS *p) {
+    freetable(p->edges);                /* free tables and entries */
+    freetable(p->corners);
+    freetable(p->centers);
     if (p->vertices.ptr)
         free((char *) p->vertices.ptr); /* free VERTEX array */
 }
 
 /* testface: given cube at lattice (i, j, k), and four corners of face,
  * if surface crosses face, compute other four corners of adjacent cube
- * and add new cube to cube stack */
+ * and add new cube to cube stack (or to out, if given) */
 
 void testface (
     int i, int j, int k,
     CUBE *old,
-    int face, int c1, int c2, int c3, int c4,   PROCESS *p)
+    int face, int c1, int c2, int c3, int c4,   PROCESS *p,
+    std::vector<CUBE> *out)
     {
     CUBE cubeNew;
     CUBES *oldcubes = p->cubes;
@@ -626,6 +974,11 @@ void testface (
         if (cubeNew.corners[n] == NULL) cubeNew.corners[n] =
             setcorner(p, i+BIT(n,2), j+BIT(n,1), k+BIT(n,0));
 
+    if (out) {
+        out->push_back(cubeNew);
+        return;
+    }
+
     /*add cube to top of stack: */
     p->cubes = (CUBES *) mycalloc(1, sizeof(CUBES));
     p->cubes->cube = cubeNew;
@@ -645,23 +998,23 @@ void setpoint (R3Pt &out_pt, int i, int j, int k, PROCESS *p)
 
 
 /* setcorner: return corner with the given lattice location
-   set (and cache) its function value */
+   set (and cache) its function value, under the lock of its shard */
 
 CORNERLIST *setcorner (PROCESS *p, int i, int j, int k) {
     /* for speed, do corner value caching here */
-    int index = HASH(i, j, k);
-    CORNERLIST *l = p->corners[index];
+    uint64_t key = KEY(i, j, k), h = mixkey(key);
+    std::unique_lock<std::mutex> lock = lockshard(p->corners, h);
+    void **item = tableitem(p->corners, key, h);
+    CORNERLIST *l;
     R3Pt pt;
-    
-    for (; l != NULL; l = l->next)
-        if (l->i == i && l->j == j && l->k == k) return l;
-            
+
+    if (*item != NULL) return (CORNERLIST *) *item;
+
     setpoint (pt, i, j, k, p);
-    l = (CORNERLIST *) mycalloc(1, sizeof(CORNERLIST));
+    l = (CORNERLIST *) arenaalloc(&getshard(p->corners, h)->arena, sizeof(CORNERLIST));
     l->i = i; l->j = j; l->k = k;
     l->value = p->function(pt);
-    l->next = p->corners[index];
-    p->corners[index] = l;
+    *item = l;
     return l;
 }
 
@@ -693,54 +1046,85 @@ TEST find (int sign, PROCESS *p, const R3Pt &in_pt)
 /**** Tetrahedral Polygonization ****/
 
 
-/* dotet: triangulate the tetrahedron
- * b, c, d should appear clockwise when viewed from a
- * return 0 if client aborts, 1 otherwise */
+/* tetcases: the 16 cases of the tetrahedron a, b, c, d (as for dotet):
+ * vert(x, y) returns the vertex id of edge xy, tri(e1, e2, e3) is called for
+ * each triangle and returns 0 to abort */
 
-int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p) {
-    CORNERLIST *a = cube->corners[c1];
-    CORNERLIST *b = cube->corners[c2];
-    CORNERLIST *c = cube->corners[c3];
-    CORNERLIST *d = cube->corners[c4];
+template <class Vert, class Tri>
+static int tetcases (CORNERLIST *a, CORNERLIST *b, CORNERLIST *c, CORNERLIST *d,
+                     Vert vert, Tri tri) {
     int index = 0, apos, bpos, cpos, dpos, e1, e2, e3, e4, e5, e6;
     if (apos = (a->value > 0.0)) index += 8;
     if (bpos = (b->value > 0.0)) index += 4;
     if (cpos = (c->value > 0.0)) index += 2;
     if (dpos = (d->value > 0.0)) index += 1;
     /* index now 4-bit number equal to one of the 16 possible cases */
-    if (apos != bpos) e1 = vertid(a, b, p);
-    if (apos != cpos) e2 = vertid(a, c, p);
-    if (apos != dpos) e3 = vertid(a, d, p);
-    if (bpos != cpos) e4 = vertid(b, c, p);
-    if (bpos != dpos) e5 = vertid(b, d, p);
-    if (cpos != dpos) e6 = vertid(c, d, p);
+    if (apos != bpos) e1 = vert(a, b);
+    if (apos != cpos) e2 = vert(a, c);
+    if (apos != dpos) e3 = vert(a, d);
+    if (bpos != cpos) e4 = vert(b, c);
+    if (bpos != dpos) e5 = vert(b, d);
+    if (cpos != dpos) e6 = vert(c, d);
     /* 14 productive tet. cases (0000 and 1111 do not yield polygons */
     switch (index) {
-        case 1:  return p->triproc(e5, e6, e3, p->vertices);
-        case 2:  return p->triproc(e2, e6, e4, p->vertices);
-        case 3:  return p->triproc(e3, e5, e4, p->vertices) &&
-                        p->triproc(e3, e4, e2, p->vertices);
-        case 4:  return p->triproc(e1, e4, e5, p->vertices);
-        case 5:  return p->triproc(e3, e1, e4, p->vertices) &&
-                        p->triproc(e3, e4, e6, p->vertices);
-        case 6:  return p->triproc(e1, e2, e6, p->vertices) &&
-                        p->triproc(e1, e6, e5, p->vertices);
-        case 7:  return p->triproc(e1, e2, e3, p->vertices);
-        case 8:  return p->triproc(e1, e3, e2, p->vertices);
-        case 9:  return p->triproc(e1, e5, e6, p->vertices) &&
-                        p->triproc(e1, e6, e2, p->vertices);
-        case 10: return p->triproc(e1, e3, e6, p->vertices) &&
-                        p->triproc(e1, e6, e4, p->vertices);
-        case 11: return p->triproc(e1, e5, e4, p->vertices);
-        case 12: return p->triproc(e3, e2, e4, p->vertices) &&
-                        p->triproc(e3, e4, e5, p->vertices);
-        case 13: return p->triproc(e6, e2, e4, p->vertices);
-        case 14: return p->triproc(e5, e3, e6, p->vertices);
+        case 1:  return tri(e5, e6, e3);
+        case 2:  return tri(e2, e6, e4);
+        case 3:  return tri(e3, e5, e4) &&
+                        tri(e3, e4, e2);
+        case 4:  return tri(e1, e4, e5);
+        case 5:  return tri(e3, e1, e4) &&
+                        tri(e3, e4, e6);
+        case 6:  return tri(e1, e2, e6) &&
+                        tri(e1, e6, e5);
+        case 7:  return tri(e1, e2, e3);
+        case 8:  return tri(e1, e3, e2);
+        case 9:  return tri(e1, e5, e6) &&
+                        tri(e1, e6, e2);
+        case 10: return tri(e1, e3, e6) &&
+                        tri(e1, e6, e4);
+        case 11: return tri(e1, e5, e4);
+        case 12: return tri(e3, e2, e4) &&
+                        tri(e3, e4, e5);
+        case 13: return tri(e6, e2, e4);
+        case 14: return tri(e5, e3, e6);
     }
     return 1;
 }
 
 
+/* dotet: triangulate the tetrahedron
+ * b, c, d should appear clockwise when viewed from a
+ * return 0 if client aborts, 1 otherwise */
+
+int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p) {
+    return tetcases(cube->corners[c1], cube->corners[c2],
+                    cube->corners[c3], cube->corners[c4],
+                    [p](CORNERLIST *x, CORNERLIST *y) {return vertid(x, y, p);},
+                    [p](int i1, int i2, int i3) {
+                        return p->triproc(i1, i2, i3, p->vertices);});
+}
+
+
+/* dotet_parallel: as dotet, the triangles are appended to out_tris as the
+ * edges of their vertices, which are numbered later */
+
+int dotet_parallel (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p,
+                    std::vector<EDGELIST *> &out_tris) {
+    EDGELIST *e[6];
+    int n = 0;
+    return tetcases(cube->corners[c1], cube->corners[c2],
+                    cube->corners[c3], cube->corners[c4],
+                    [&](CORNERLIST *x, CORNERLIST *y) {
+                        e[n] = setedge(x, y, p);
+                        return n++;},
+                    [&](int i1, int i2, int i3) {
+                        out_tris.push_back(e[i1]);
+                        out_tris.push_back(e[i2]);
+                        out_tris.push_back(e[i3]);
+                        return 1;});
+}
+
+
 /**** Storage ****/
 
 
@@ -754,57 +1138,165 @@ char *mycalloc (int nitems, int nbytes) {
 }
 
 
-/* setcenter: set (i,j,k) entry of table[]
+/* setcenter: set (i,j,k) entry of table
  * return 1 if already set; otherwise, set and return 0 */
 
-int setcenter(CENTERLIST *table[], int i, int j, int k) {
-    int index = HASH(i, j, k);
-    CENTERLIST *centerListNew, *l, *q = table[index];
-    for (l = q; l != NULL; l = l->next)
-        if (l->i == i && l->j == j && l->k == k) return 1;
-    centerListNew = (CENTERLIST *) mycalloc(1, sizeof(CENTERLIST));
-    centerListNew->i = i; centerListNew->j = j; centerListNew->k = k; centerListNew->next = q;
-    table[index] = centerListNew;
+int setcenter(TABLE *table, int i, int j, int k) {
+    uint64_t key = KEY(i, j, k), h = mixkey(key);
+    std::unique_lock<std::mutex> lock = lockshard(table, h);
+    void **item = tableitem(table, key, h);
+    if (*item != NULL) return 1;
+    *item = (void *) table;                  /* any non-NULL entry */
     return 0;
 }
 
 
-/* setedge: set vertex id for edge */
+/* getcenter: 1 if the (i,j,k) entry of table is set; not locked */
 
-void setedge (
-    EDGELIST *table[],
-    int i1, int j1, int k1, int i2, int j2, int k2, int vid)
-    {
-    unsigned int index;
-    EDGELIST *edgeListNew;
-    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
-        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
+int getcenter(TABLE *table, int i, int j, int k) {
+    uint64_t key = KEY(i, j, k);
+    void **item = findtableitem(table, key, mixkey(key));
+    return item != NULL && *item != NULL;
+}
+
+
+/* edgekey: key of the edge between neighboring corners, the lesser corner
+ * and the direction to the other (27 cases) */
+
+uint64_t edgekey (int i1, int j1, int k1, int i2, int j2, int k2) {
+    uint64_t a = KEY(i1, j1, k1), b = KEY(i2, j2, k2);
+    int dir = (i2-i1+1)*9 + (j2-j1+1)*3 + (k2-k1+1);
+    if (a > b) {a = b; dir = 26-dir;}
+    return a<<5 | dir;
+}
+
+
+/* mixkey: hash of a key (the splitmix64 finalizer); its low bits give the
+ * slot in a shard and its high bits the shard */
+
+uint64_t mixkey (uint64_t key) {
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+
+/* getshard: shard of hash h */
+
+SHARD *getshard (TABLE *table, uint64_t h) {
+    return &table->shards[h >> (64-SHARDBITS)];
+}
+
+
+/* lockshard: lock the shard of hash h, if the table is shared by threads */
+
+std::unique_lock<std::mutex> lockshard (TABLE *table, uint64_t h) {
+    if (table->locks == NULL) return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(table->locks[h >> (64-SHARDBITS)]);
+}
+
+
+/* growshard: double the slots of shard s */
+
+void growshard (SHARD *s) {
+    uint64_t *keys = s->keys;
+    void **items = s->items;
+    size_t n = s->mask+1, i, m;
+    s->mask = 2*n-1;
+    s->keys  = (uint64_t *) mycalloc(2*n, sizeof(uint64_t));
+    s->items = (void **)    mycalloc(2*n, sizeof(void *));
+    for (i = 0; i < n; i++) {
+        if (keys[i] == 0) continue;
+        for (m = mixkey(keys[i]) & s->mask; s->keys[m] != 0; m = (m+1) & s->mask);
+        s->keys[m] = keys[i];
+        s->items[m] = items[i];
     }
-    index = HASH(i1, j1, k1) + HASH(i2, j2, k2);
-    edgeListNew = (EDGELIST *) mycalloc(1, sizeof(EDGELIST));
-    edgeListNew->i1 = i1; edgeListNew->j1 = j1; edgeListNew->k1 = k1;
-    edgeListNew->i2 = i2; edgeListNew->j2 = j2; edgeListNew->k2 = k2;
-    edgeListNew->vid = vid;
-    edgeListNew->next = table[index];
-    table[index] = edgeListNew;
+    free((char *) keys);
+    free((char *) items);
 }
 
 
-/* getedge: return vertex id for edge; return -1 if not set */
+/* tableitem: return the entry slot of key (hash h), adding the key with a
+ * NULL entry if new; the slot is valid until the next key is added to the
+ * shard, so the shard stays locked meanwhile */
 
-int getedge (EDGELIST *table[],
-             int i1, int j1, int k1, int i2, int j2, int k2)
-    {
-    EDGELIST *q;
-    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
-        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
+void **tableitem (TABLE *table, uint64_t key, uint64_t h) {
+    SHARD *s = getshard(table, h);
+    size_t m;
+    for (m = h & s->mask; s->keys[m] != 0; m = (m+1) & s->mask)
+        if (s->keys[m] == key) return &s->items[m];
+    if (2*(s->count+1) > s->mask+1) {        /* keep load <= 1/2 */
+        growshard(s);
+        for (m = h & s->mask; s->keys[m] != 0; m = (m+1) & s->mask);
+    }
+    s->keys[m] = key;
+    s->count++;
+    return &s->items[m];
+}
+
+
+/* findtableitem: return the entry slot of key (hash h), NULL if the key is
+ * not in the table */
+
+void **findtableitem (TABLE *table, uint64_t key, uint64_t h) {
+    SHARD *s = getshard(table, h);
+    size_t m;
+    for (m = h & s->mask; s->keys[m] != 0; m = (m+1) & s->mask)
+        if (s->keys[m] == key) return &s->items[m];
+    return NULL;
+}
+
+
+/* newtable: empty table, locked by locks[NSHARD] if not NULL */
+
+TABLE *newtable (std::mutex *locks) {
+    TABLE *table = new TABLE;
+    for (int n = 0; n < NSHARD; n++) {
+        SHARD *s = &table->shards[n];
+        s->keys  = (uint64_t *) mycalloc(SHARDSIZE, sizeof(uint64_t));
+        s->items = (void **)    mycalloc(SHARDSIZE, sizeof(void *));
+        s->mask = SHARDSIZE-1;
+        s->count = 0;
+        s->arena.ptr = s->arena.end = s->arena.blocks = NULL;
     }
-    q = table[HASH(i1, j1, k1)+HASH(i2, j2, k2)];
-    for (; q != NULL; q = q->next)
-        if (q->i1 == i1 && q->j1 == j1 && q->k1 == k1 &&
-            q->i2 == i2 && q->j2 == j2 && q->k2 == k2)
-            return q->vid;
-    return -1;
+    table->locks = locks;
+    return table;
+}
+
+
+/* freetable: free table and the entries in its arenas */
+
+void freetable (TABLE *table) {
+    for (int n = 0; n < NSHARD; n++) {
+        SHARD *s = &table->shards[n];
+        free((char *) s->keys);
+        free((char *) s->items);
+        while (s->arena.blocks) {
+            char *next = *(char **) s->arena.blocks;
+            free(s->arena.blocks);
+            s->arena.blocks = next;
+        }
+    }
+    delete table;
+}
+
+
+/* arenaalloc: return nbytes of zeroed storage from arena */
+
+char *arenaalloc (ARENA *arena, int nbytes) {
+    char *ptr;
+    nbytes = (nbytes+15) & ~15;              /* keep 16-byte alignment */
+    if (arena->ptr == NULL || arena->ptr+nbytes > arena->end) {
+        int size = nbytes+16 > ARENASIZE ? nbytes+16 : ARENASIZE;
+        char *block = mycalloc(1, size);
+        *(char **) block = arena->blocks;
+        arena->blocks = block;
+        arena->ptr = block+16;
+        arena->end = block+size;
+    }
+    ptr = arena->ptr;
+    arena->ptr += nbytes;
+    return ptr;
 }
 
 
@@ -813,6 +1305,8 @@ int addtovertices (VERTICES *vertices, VERTEX v);
 
 void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_v);
 
+void edgevertex (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p, VERTEX &v);
+
 
 
 /* vertid: return index for vertex on edge:
@@ -820,18 +1314,45 @@ void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_v);
  * return saved index if any; else compute vertex and save */
 
 int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p) {
-    VERTEX v;
+    EDGELIST *e = setedge(c1, c2, p);
+    if (e->vid == -1) e->vid = addtovertices(&p->vertices, e->vertex); /* save */
+    return e->vid;
+}
+
+
+/* setedge: return the entry of edge c1, c2, under the lock of its shard;
+ * a new entry has its vertex computed and vid -1 */
+
+EDGELIST *setedge (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p) {
+    uint64_t key = edgekey(c1->i, c1->j, c1->k, c2->i, c2->j, c2->k);
+    uint64_t h = mixkey(key);
+    std::unique_lock<std::mutex> lock = lockshard(p->edges, h);
+    void **item = tableitem(p->edges, key, h);
+    EDGELIST *e;
+    if (*item != NULL) return (EDGELIST *) *item;  /* previously computed */
+    e = (EDGELIST *) arenaalloc(&getshard(p->edges, h)->arena, sizeof(EDGELIST));
+    e->vid = -1;
+    edgevertex(c1, c2, p, e->vertex);
+    *item = e;
+    return e;
+}
+
+
+/* edgevertex: vertex (position and normal) on the edge c1, c2 */
+
+void edgevertex (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p, VERTEX &v) {
     R3Pt a, b;
-    int vid =
-        getedge(p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k);
-    if (vid != -1) return vid;                /* previously computed */
     setpoint (a, c1->i, c1->j, c1->k, p);
     setpoint (b, c2->i, c2->j, c2->k, p);
-    converge (a, b, c1->value, p->function, v.position); /* posn.  */
-    vnormal(v.position, p, v.normal);                     /* normal */
-    vid = addtovertices(&p->vertices, v);                   /* save   */
-    setedge(p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k, vid);
-    return vid;
+    if (p->gradient) {
+        R3Vec grad;
+        converge_gradient (a, b, c1->value, c2->value, p->gradient, v.position, grad);
+        v.normal = UnitSafe( grad );
+    }
+    else {
+        converge (a, b, c1->value, p->function, v.position); /* posn.  */
+        vnormal(v.position, p, v.normal);                     /* normal */
+    }
 }
 
 
@@ -911,3 +1432,51 @@ void converge ( const R3Pt &in_p1, const R3Pt &in_p2, double v,
         else {neg = out_p;}
     }
 }
+
+
+/* converge_gradient: from two points of differing sign (values v1, v2),
+ * converge to surface with Newton steps along the edge, started from the
+ * secant of the two values; a step leaving the bracket of the sign change
+ * is replaced by bisection. out_grad is the gradient at the last evaluation */
+
+void converge_gradient ( const R3Pt &in_p1, const R3Pt &in_p2, double v1, double v2,
+                         double (*gradient)(const R3Pt &in_pt, R3Vec &out_grad),
+                         R3Pt &out_p, R3Vec &out_grad)
+{
+    const R3Vec edge = in_p2 - in_p1;
+    double lo = 0, hi = 1, flo = v1;
+    double t = v1 / (v1 - v2);
+    for (int i = 0;; i++) {
+
+        out_p = Lerp( in_p1, in_p2, t );
+
+        double f = gradient( out_p, out_grad );
+        if (f == 0.0 || i == RES) return;
+
+        if ((f > 0.0) == (flo > 0.0)) {lo = t; flo = f;}
+        else {hi = t;}
+
+        double dfdt = Dot( out_grad, edge );
+        double tn = dfdt != 0.0 ? t - f / dfdt : lo;
+        if (!(tn > lo && tn < hi)) tn = 0.5 * (lo + hi);
+
+        if (fabs(tn - t) < NEWTON_TOL) {
+            out_p = Lerp( in_p1, in_p2, tn );
+            return;
+        }
+        t = tn;
+    }
+}
+
+/* batch_checked: see Polygonizer.h */
+
+bool batch_checked ( void (*batch)(const double *in_pts, int m, double *out_values),
+                     bool (*continueproc)(),
+                     const double *in_pts, size_t m, double *out_values)
+{
+    for (size_t b = 0; b < m; b += BATCHBLOCK) {
+        if (continueproc && !continueproc()) return false;
+        batch(in_pts+3*b, (int)std::min((size_t)BATCHBLOCK, m-b), out_values+b);
+    }
+    return true;
+}
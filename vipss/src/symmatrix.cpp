@@ -0,0 +1,215 @@
+#include "symmatrix.h"
+#include "utility.h"
+#include <cmath>
+#include <algorithm>
+
+
+void SymMatrix::pack(const arma::mat &A){
+
+    n = A.n_rows;
+    issingle = false;
+    vector<float>().swap(apf);
+    ap.resize(size_t(n)*(n+1)/2);
+    double *p_ap = ap.data();
+    for(int j=0;j<n;++j){
+        const double *col = A.colptr(j);
+        for(int i=0;i<=j;++i)*p_ap++ = col[i];
+    }
+}
+
+void SymMatrix::packSingle(const SymMatrix &A){
+
+    n = A.n;
+    issingle = true;
+    vector<double>().swap(ap);
+    apf.resize(size_t(n)*(n+1)/2);
+    if(A.issingle)apf = A.apf;
+    else for(size_t i=0;i<apf.size();++i)apf[i] = float(A.ap[i]);
+}
+
+template <typename T>
+static void unpack_columns(const T *p_ap, arma::mat &A, int n){
+
+    A.set_size(n,n);
+    for(int j=0;j<n;++j){
+        double *col = A.colptr(j);
+        for(int i=0;i<=j;++i)col[i] = p_ap[i];
+        for(int i=0;i<j;++i)A(j,i) = p_ap[i];
+        p_ap += j+1;
+    }
+}
+
+void SymMatrix::unpack(arma::mat &A) const{
+
+    if(issingle)unpack_columns(apf.data(), A, n);
+    else unpack_columns(ap.data(), A, n);
+}
+
+void SymMatrix::clear(){
+    n = 0;
+    issingle = false;
+    vector<double>().swap(ap);
+    vector<float>().swap(apf);
+}
+
+//rows [0, c1) of y += A(:, c0:c1-1) * x(c0:c1-1), the columns read once for both triangles
+template <typename T>
+static void symv_columns(const T *ap, const double *x, double *y, int c0, int c1){
+
+    for(int j=c0;j<c1;++j){
+        const T *col = ap + size_t(j)*(j+1)/2;
+        double xj = x[j];
+        double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        int i = 0;
+        for(;i+4<=j;i+=4){
+            y[i] += col[i]*xj;
+            y[i+1] += col[i+1]*xj;
+            y[i+2] += col[i+2]*xj;
+            y[i+3] += col[i+3]*xj;
+            s0 += col[i]*x[i];
+            s1 += col[i+1]*x[i+1];
+            s2 += col[i+2]*x[i+2];
+            s3 += col[i+3]*x[i+3];
+        }
+        for(;i<j;++i){
+            y[i] += col[i]*xj;
+            s0 += col[i]*x[i];
+        }
+        y[j] += (s0 + s1) + (s2 + s3) + col[j]*xj;
+    }
+}
+
+//rows [0, c1) of Y += A(:, c0:c1-1) * X(c0:c1-1, r0:r0+KB-1) for k vectors stored interleaved
+//(X[i*k+r]); KB is a compile time constant so the loops over the vectors are unrolled/vectorized.
+//Two columns are done per sweep, so the rows of X and Y are loaded once for both
+template <typename T, int KB>
+static void symm_block(const T *ap, const double *X, double *Y, int k, int r0, int c0, int c1){
+
+    double xj0[KB], xj1[KB], s0[KB], s1[KB];
+    int j = c0;
+    for(;j+2<=c1;j+=2){
+        const T *col0 = ap + size_t(j)*(j+1)/2;
+        const T *col1 = col0 + j+1;
+        for(int r=0;r<KB;++r){
+            xj0[r] = X[size_t(j)*k+r0+r];
+            xj1[r] = X[size_t(j+1)*k+r0+r];
+            s0[r] = s1[r] = 0;
+        }
+        for(int i=0;i<j;++i){
+            double a0 = col0[i], a1 = col1[i];
+            const double *xi = X + size_t(i)*k + r0;
+            double *yi = Y + size_t(i)*k + r0;
+            for(int r=0;r<KB;++r){
+                yi[r] += a0*xj0[r] + a1*xj1[r];
+                s0[r] += a0*xi[r];
+                s1[r] += a1*xi[r];
+            }
+        }
+        //the 2x2 diagonal block (j, j+1)
+        double *yj0 = Y + size_t(j)*k + r0, *yj1 = yj0 + k;
+        for(int r=0;r<KB;++r){
+            yj0[r] += s0[r] + col0[j]*xj0[r] + col1[j]*xj1[r];
+            yj1[r] += s1[r] + col1[j]*xj0[r] + col1[j+1]*xj1[r];
+        }
+    }
+    for(;j<c1;++j){
+        const T *col = ap + size_t(j)*(j+1)/2;
+        for(int r=0;r<KB;++r){
+            xj0[r] = X[size_t(j)*k+r0+r];
+            s0[r] = 0;
+        }
+        for(int i=0;i<j;++i){
+            double a = col[i];
+            const double *xi = X + size_t(i)*k + r0;
+            double *yi = Y + size_t(i)*k + r0;
+            for(int r=0;r<KB;++r){
+                yi[r] += a*xj0[r];
+                s0[r] += a*xi[r];
+            }
+        }
+        double *yj = Y + size_t(j)*k + r0;
+        for(int r=0;r<KB;++r)yj[r] += s0[r] + col[j]*xj0[r];
+    }
+}
+
+//the vectors are split in blocks of at most 4 as even as possible (5 = 3+2), each column is read
+//once per block
+template <typename T>
+static void symm_columns(const T *ap, const double *X, double *Y, int k, int c0, int c1){
+
+    int n_block = (k+3)/4;
+    for(int b=0, r0=0;b<n_block;++b){
+        int kb = (k-r0)/(n_block-b);
+        switch(kb){
+        case 4: symm_block<T,4>(ap, X, Y, k, r0, c0, c1); break;
+        case 3: symm_block<T,3>(ap, X, Y, k, r0, c0, c1); break;
+        case 2: symm_block<T,2>(ap, X, Y, k, r0, c0, c1); break;
+        case 1: symm_block<T,1>(ap, X, Y, k, r0, c0, c1); break;
+        }
+        r0 += kb;
+    }
+}
+
+//Y (n x k values) = sum of func(t, cut[t], cut[t+1], partial) over n_threads column blocks of equal work,
+//each block writing the rows [0, cut[t+1]) of its own partial result
+template <class Func>
+static void split_columns(int n, int k, int n_threads, double *Y, vector<double> &work, Func func){
+
+    //column j holds j+1 entries, so equal work means equal area under the triangle
+    vector<int>cut(n_threads+1);
+    for(int t=0;t<=n_threads;++t)cut[t] = int(n * sqrt(double(t)/n_threads));
+    cut[n_threads] = n;
+
+    size_t len = size_t(n)*k;
+    work.resize(n_threads*len);
+    MyUtility::parallelFor(n_threads, n_threads, [&](int t, int){
+        double *yt = work.data() + t*len;
+        for(size_t i=0;i<size_t(cut[t+1])*k;++i)yt[i] = 0;
+        func(cut[t], cut[t+1], yt);
+    });
+
+    for(int i=0;i<n;++i){
+        for(int r=0;r<k;++r){
+            double s = 0;
+            for(int t=0;t<n_threads;++t)if(i<cut[t+1])s += work[t*len+size_t(i)*k+r];
+            Y[size_t(i)*k+r] = s;
+        }
+    }
+}
+
+void SymMatrix::symv(const double *x, double *y, int n_threads, vector<double> &work) const{
+
+    //below about a million entries the product is cheaper than starting the threads
+    if(size_t(n)*n < 2000000)n_threads = 1;
+    if(n_threads<=1){
+        for(int i=0;i<n;++i)y[i] = 0;
+        if(issingle)symv_columns(apf.data(), x, y, 0, n);
+        else symv_columns(ap.data(), x, y, 0, n);
+        return;
+    }
+
+    split_columns(n, 1, n_threads, y, work, [&](int c0, int c1, double *yt){
+        if(issingle)symv_columns(apf.data(), x, yt, c0, c1);
+        else symv_columns(ap.data(), x, yt, c0, c1);
+    });
+}
+
+void SymMatrix::symm(const double *X, double *Y, int k, int n_threads, vector<double> &work) const{
+
+    if(k==1){
+        symv(X, Y, n_threads, work);
+        return;
+    }
+    if(size_t(n)*n < 2000000)n_threads = 1;
+    if(n_threads<=1){
+        for(size_t i=0;i<size_t(n)*k;++i)Y[i] = 0;
+        if(issingle)symm_columns(apf.data(), X, Y, k, 0, n);
+        else symm_columns(ap.data(), X, Y, k, 0, n);
+        return;
+    }
+
+    split_columns(n, k, n_threads, Y, work, [&](int c0, int c1, double *yt){
+        if(issingle)symm_columns(apf.data(), X, yt, k, c0, c1);
+        else symm_columns(ap.data(), X, yt, k, c0, c1);
+    });
+}
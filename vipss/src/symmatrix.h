@@ -0,0 +1,42 @@
+#ifndef SYMMATRIX_H
+#define SYMMATRIX_H
+
+
+#include <vector>
+#include <armadillo>
+using namespace std;
+
+
+//symmetric n x n matrix stored as its packed upper triangle, column major (the LAPACK 'U' packed
+//layout): entry (i,j), i<=j, is at ap[i + j*(j+1)/2]. Half the memory and half the memory traffic
+//per matrix-vector product of a full arma::mat. With issingle the entries are kept in apf as floats,
+//products are still accumulated in double
+class SymMatrix{
+
+public:
+    int n = 0;
+    bool issingle = false;
+    vector<double>ap;
+    vector<float>apf;
+
+public:
+    SymMatrix(){}
+
+    void pack(const arma::mat &A);
+    void packSingle(const SymMatrix &A);
+    void unpack(arma::mat &A) const;
+    void clear();
+    bool empty() const {return n==0;}
+
+    //y = A*x; with n_threads>1 the columns are split in blocks of equal work and every thread
+    //accumulates its rows into its own slice of work (resized to n_threads*n)
+    void symv(const double *x, double *y, int n_threads, vector<double> &work) const;
+
+    //Y = A*X for k vectors stored interleaved, X[i*k+r] is entry i of vector r; A is read once for
+    //all of them, so k products cost little more than one when the matrix does not fit in cache
+    void symm(const double *X, double *Y, int k, int n_threads, vector<double> &work) const;
+};
+
+
+
+#endif // SYMMATRIX_H
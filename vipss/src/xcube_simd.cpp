@@ -0,0 +1,402 @@
+#include "xcube_simd.h"
+#include <cmath>
+
+//mul and add must not be fused into FMA, which only the AVX-512 target has, else its results
+//would not match the other levels
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define XCUBE_SIMD_X86
+#include <immintrin.h>
+#endif
+
+
+namespace XCubeSIMD{
+
+static const double r_eps = 1e-8;
+
+static int detectLevel(){
+#ifdef XCUBE_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))return AVX512;
+    if(__builtin_cpu_supports("avx2"))return AVX2;
+#endif
+    return SCALAR;
+}
+
+static const int s_supported = detectLevel();
+static int s_level = s_supported;
+
+int level(){return s_level;}
+
+void setLevel(int l){
+    s_level = l < SCALAR ? SCALAR : l > s_supported ? s_supported : l;
+}
+
+const char *levelName(){
+    switch(s_level){
+    case AVX512: return "avx512";
+    case AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+
+/*************************************************************/
+//scalar reference, every vector version below follows it operation by operation
+
+static inline void vgh_scalar(const double *p, const double *cx, const double *cy, const double *cz, int i, int n,
+                              double *K, double *G, double *H){
+
+    double dx = p[0]-cx[i], dy = p[1]-cy[i], dz = p[2]-cz[i];
+    double d2 = dx*dx + dy*dy + dz*dz;
+    double r = sqrt(d2);
+    double t = 3*r;
+    K[i] = d2*r;
+    G[i] = t*dx; G[i+n] = t*dy; G[i+n*2] = t*dz;
+    if(r<r_eps){
+        for(int k=0;k<6;++k)H[i+k*n] = 0;
+    }else{
+        double s = 3/r;
+        double sx = s*dx, sy = s*dy, sz = s*dz;
+        H[i] = sx*dx + t; H[i+n] = sx*dy; H[i+n*2] = sx*dz;
+        H[i+n*3] = sy*dy + t; H[i+n*4] = sy*dz; H[i+n*5] = sz*dz + t;
+    }
+}
+
+static inline double term_scalar(double px, double py, double pz, double cx, double cy, double cz,
+                                 double w, double ux, double uy, double uz){
+
+    double dx = px-cx, dy = py-cy, dz = pz-cz;
+    double d2 = dx*dx + dy*dy + dz*dz;
+    double r = sqrt(d2);
+    return w*(d2*r) + (3*r)*(ux*dx + uy*dy + uz*dz);
+}
+
+//the Width partial sums are folded as (acc[l] + acc[l+4]), then (+ the one 2 apart), then the last two
+static inline double fold(const double *acc){
+    double s4[4], s2[2];
+    for(int l=0;l<4;++l)s4[l] = acc[l] + acc[l+4];
+    for(int l=0;l<2;++l)s2[l] = s4[l] + s4[l+2];
+    return s2[0] + s2[1];
+}
+
+static double contract_scalar(const double *p, const double *cx, const double *cy, const double *cz,
+                              const double *w, const double *ux, const double *uy, const double *uz, int n){
+
+    double acc[Width] = {0,0,0,0,0,0,0,0};
+    for(int i=0;i<n;i+=Width)for(int l=0;l<Width;++l)
+        acc[l] += term_scalar(p[0],p[1],p[2],cx[i+l],cy[i+l],cz[i+l],w[i+l],ux[i+l],uy[i+l],uz[i+l]);
+    return fold(acc);
+}
+
+//value and gradient terms of one center, v[0] += value, v[1..3] += gradient
+static inline void termGradient_scalar(const double *p, double cx, double cy, double cz,
+                                       double w, double ux, double uy, double uz, double *v){
+
+    double dx = p[0]-cx, dy = p[1]-cy, dz = p[2]-cz;
+    double d2 = dx*dx + dy*dy + dz*dz;
+    double r = sqrt(d2);
+    double g = 3*r;
+    double h = r<r_eps ? 0 : 3/r;
+    double du = ux*dx + uy*dy + uz*dz;
+    v[0] += w*(d2*r) + g*du;
+    double s = w*g + h*du;
+    v[1] += s*dx + g*ux;
+    v[2] += s*dy + g*uy;
+    v[3] += s*dz + g*uz;
+}
+
+static double contractGradient_scalar(const double *p, const double *cx, const double *cy, const double *cz,
+                                      const double *w, const double *ux, const double *uy, const double *uz, int n, double *grad){
+
+    double acc[4][Width];
+    for(int k=0;k<4;++k)for(int l=0;l<Width;++l)acc[k][l] = 0;
+    for(int i=0;i<n;i+=Width)for(int l=0;l<Width;++l){
+        double v[4] = {acc[0][l], acc[1][l], acc[2][l], acc[3][l]};
+        termGradient_scalar(p,cx[i+l],cy[i+l],cz[i+l],w[i+l],ux[i+l],uy[i+l],uz[i+l],v);
+        for(int k=0;k<4;++k)acc[k][l] = v[k];
+    }
+    for(int k=0;k<3;++k)grad[k] += fold(acc[k+1]);
+    return fold(acc[0]);
+}
+
+static void contractBlock_scalar(const double *qx, const double *qy, const double *qz, int nq,
+                                 const double *cx, const double *cy, const double *cz,
+                                 const double *w, const double *ux, const double *uy, const double *uz, int n, double *acc){
+
+    for(int i=0;i<n;++i)for(int j=0;j<nq;++j)
+        acc[j] += term_scalar(qx[j],qy[j],qz[j],cx[i],cy[i],cz[i],w[i],ux[i],uy[i],uz[i]);
+}
+
+
+#ifdef XCUBE_SIMD_X86
+/*************************************************************/
+//AVX2, 4 lanes
+
+#define XCUBE_AVX2 __attribute__((target("avx2")))
+
+XCUBE_AVX2 static inline __m256d term_avx2(__m256d px, __m256d py, __m256d pz, __m256d cx, __m256d cy, __m256d cz,
+                                          __m256d w, __m256d ux, __m256d uy, __m256d uz){
+
+    __m256d dx = _mm256_sub_pd(px,cx), dy = _mm256_sub_pd(py,cy), dz = _mm256_sub_pd(pz,cz);
+    __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx,dx),_mm256_mul_pd(dy,dy)),_mm256_mul_pd(dz,dz));
+    __m256d r = _mm256_sqrt_pd(d2);
+    __m256d dot = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ux,dx),_mm256_mul_pd(uy,dy)),_mm256_mul_pd(uz,dz));
+    __m256d g = _mm256_mul_pd(_mm256_set1_pd(3),r);
+    return _mm256_add_pd(_mm256_mul_pd(w,_mm256_mul_pd(d2,r)),_mm256_mul_pd(g,dot));
+}
+
+XCUBE_AVX2 static void vgh_avx2(const double *p, const double *cx, const double *cy, const double *cz, int n,
+                               double *K, double *G, double *H){
+
+    const __m256d px = _mm256_set1_pd(p[0]), py = _mm256_set1_pd(p[1]), pz = _mm256_set1_pd(p[2]);
+    const __m256d three = _mm256_set1_pd(3), eps = _mm256_set1_pd(r_eps);
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        __m256d dx = _mm256_sub_pd(px,_mm256_loadu_pd(cx+i));
+        __m256d dy = _mm256_sub_pd(py,_mm256_loadu_pd(cy+i));
+        __m256d dz = _mm256_sub_pd(pz,_mm256_loadu_pd(cz+i));
+        __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx,dx),_mm256_mul_pd(dy,dy)),_mm256_mul_pd(dz,dz));
+        __m256d r = _mm256_sqrt_pd(d2);
+        __m256d t = _mm256_mul_pd(three,r);
+        _mm256_storeu_pd(K+i,_mm256_mul_pd(d2,r));
+        _mm256_storeu_pd(G+i,_mm256_mul_pd(t,dx));
+        _mm256_storeu_pd(G+i+n,_mm256_mul_pd(t,dy));
+        _mm256_storeu_pd(G+i+n*2,_mm256_mul_pd(t,dz));
+        __m256d mask = _mm256_cmp_pd(r,eps,_CMP_GE_OQ);
+        __m256d s = _mm256_div_pd(three,r);
+        __m256d sx = _mm256_mul_pd(s,dx), sy = _mm256_mul_pd(s,dy), sz = _mm256_mul_pd(s,dz);
+        _mm256_storeu_pd(H+i,_mm256_and_pd(mask,_mm256_add_pd(_mm256_mul_pd(sx,dx),t)));
+        _mm256_storeu_pd(H+i+n,_mm256_and_pd(mask,_mm256_mul_pd(sx,dy)));
+        _mm256_storeu_pd(H+i+n*2,_mm256_and_pd(mask,_mm256_mul_pd(sx,dz)));
+        _mm256_storeu_pd(H+i+n*3,_mm256_and_pd(mask,_mm256_add_pd(_mm256_mul_pd(sy,dy),t)));
+        _mm256_storeu_pd(H+i+n*4,_mm256_and_pd(mask,_mm256_mul_pd(sy,dz)));
+        _mm256_storeu_pd(H+i+n*5,_mm256_and_pd(mask,_mm256_add_pd(_mm256_mul_pd(sz,dz),t)));
+    }
+    for(;i<n;++i)vgh_scalar(p,cx,cy,cz,i,n,K,G,H);
+}
+
+XCUBE_AVX2 static double contract_avx2(const double *p, const double *cx, const double *cy, const double *cz,
+                                      const double *w, const double *ux, const double *uy, const double *uz, int n){
+
+    const __m256d px = _mm256_set1_pd(p[0]), py = _mm256_set1_pd(p[1]), pz = _mm256_set1_pd(p[2]);
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    for(int i=0;i<n;i+=Width){
+        acc0 = _mm256_add_pd(acc0,term_avx2(px,py,pz,_mm256_loadu_pd(cx+i),_mm256_loadu_pd(cy+i),_mm256_loadu_pd(cz+i),
+                                            _mm256_loadu_pd(w+i),_mm256_loadu_pd(ux+i),_mm256_loadu_pd(uy+i),_mm256_loadu_pd(uz+i)));
+        acc1 = _mm256_add_pd(acc1,term_avx2(px,py,pz,_mm256_loadu_pd(cx+i+4),_mm256_loadu_pd(cy+i+4),_mm256_loadu_pd(cz+i+4),
+                                            _mm256_loadu_pd(w+i+4),_mm256_loadu_pd(ux+i+4),_mm256_loadu_pd(uy+i+4),_mm256_loadu_pd(uz+i+4)));
+    }
+    double acc[Width];
+    _mm256_storeu_pd(acc,acc0);
+    _mm256_storeu_pd(acc+4,acc1);
+    return fold(acc);
+}
+
+XCUBE_AVX2 static inline void termGradient_avx2(__m256d px, __m256d py, __m256d pz, const double *cx, const double *cy, const double *cz,
+                                              const double *w, const double *ux, const double *uy, const double *uz, __m256d *acc){
+
+    const __m256d three = _mm256_set1_pd(3), eps = _mm256_set1_pd(r_eps);
+    __m256d vux = _mm256_loadu_pd(ux), vuy = _mm256_loadu_pd(uy), vuz = _mm256_loadu_pd(uz), vw = _mm256_loadu_pd(w);
+    __m256d dx = _mm256_sub_pd(px,_mm256_loadu_pd(cx)), dy = _mm256_sub_pd(py,_mm256_loadu_pd(cy)), dz = _mm256_sub_pd(pz,_mm256_loadu_pd(cz));
+    __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx,dx),_mm256_mul_pd(dy,dy)),_mm256_mul_pd(dz,dz));
+    __m256d r = _mm256_sqrt_pd(d2);
+    __m256d g = _mm256_mul_pd(three,r);
+    __m256d mask = _mm256_cmp_pd(r,eps,_CMP_GE_OQ);
+    __m256d h = _mm256_and_pd(mask,_mm256_div_pd(three,r));
+    __m256d du = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vux,dx),_mm256_mul_pd(vuy,dy)),_mm256_mul_pd(vuz,dz));
+    acc[0] = _mm256_add_pd(acc[0],_mm256_add_pd(_mm256_mul_pd(vw,_mm256_mul_pd(d2,r)),_mm256_mul_pd(g,du)));
+    __m256d s = _mm256_add_pd(_mm256_mul_pd(vw,g),_mm256_mul_pd(h,du));
+    acc[1] = _mm256_add_pd(acc[1],_mm256_add_pd(_mm256_mul_pd(s,dx),_mm256_mul_pd(g,vux)));
+    acc[2] = _mm256_add_pd(acc[2],_mm256_add_pd(_mm256_mul_pd(s,dy),_mm256_mul_pd(g,vuy)));
+    acc[3] = _mm256_add_pd(acc[3],_mm256_add_pd(_mm256_mul_pd(s,dz),_mm256_mul_pd(g,vuz)));
+}
+
+XCUBE_AVX2 static double contractGradient_avx2(const double *p, const double *cx, const double *cy, const double *cz,
+                                             const double *w, const double *ux, const double *uy, const double *uz, int n, double *grad){
+
+    const __m256d px = _mm256_set1_pd(p[0]), py = _mm256_set1_pd(p[1]), pz = _mm256_set1_pd(p[2]);
+    __m256d acc[2][4];
+    for(int hh=0;hh<2;++hh)for(int k=0;k<4;++k)acc[hh][k] = _mm256_setzero_pd();
+    for(int i=0;i<n;i+=Width)for(int hh=0;hh<2;++hh){
+        int o = i+hh*4;
+        termGradient_avx2(px,py,pz,cx+o,cy+o,cz+o,w+o,ux+o,uy+o,uz+o,acc[hh]);
+    }
+    double lanes[4][Width];
+    for(int k=0;k<4;++k)for(int hh=0;hh<2;++hh)_mm256_storeu_pd(lanes[k]+hh*4,acc[hh][k]);
+    for(int k=0;k<3;++k)grad[k] += fold(lanes[k+1]);
+    return fold(lanes[0]);
+}
+
+XCUBE_AVX2 static void contractBlock_avx2(const double *qx, const double *qy, const double *qz, int nq,
+                                         const double *cx, const double *cy, const double *cz,
+                                         const double *w, const double *ux, const double *uy, const double *uz, int n, double *acc){
+
+    for(int i=0;i<n;++i){
+        const __m256d x = _mm256_set1_pd(cx[i]), y = _mm256_set1_pd(cy[i]), z = _mm256_set1_pd(cz[i]);
+        const __m256d wi = _mm256_set1_pd(w[i]), u0 = _mm256_set1_pd(ux[i]), u1 = _mm256_set1_pd(uy[i]), u2 = _mm256_set1_pd(uz[i]);
+        for(int j=0;j<nq;j+=4){
+            __m256d t = term_avx2(_mm256_loadu_pd(qx+j),_mm256_loadu_pd(qy+j),_mm256_loadu_pd(qz+j),x,y,z,wi,u0,u1,u2);
+            _mm256_storeu_pd(acc+j,_mm256_add_pd(_mm256_loadu_pd(acc+j),t));
+        }
+    }
+}
+
+
+/*************************************************************/
+//AVX-512, 8 lanes
+
+#define XCUBE_AVX512 __attribute__((target("avx512f")))
+
+XCUBE_AVX512 static inline __m512d term_avx512(__m512d px, __m512d py, __m512d pz, __m512d cx, __m512d cy, __m512d cz,
+                                              __m512d w, __m512d ux, __m512d uy, __m512d uz){
+
+    __m512d dx = _mm512_sub_pd(px,cx), dy = _mm512_sub_pd(py,cy), dz = _mm512_sub_pd(pz,cz);
+    __m512d d2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx,dx),_mm512_mul_pd(dy,dy)),_mm512_mul_pd(dz,dz));
+    __m512d r = _mm512_sqrt_pd(d2);
+    __m512d dot = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ux,dx),_mm512_mul_pd(uy,dy)),_mm512_mul_pd(uz,dz));
+    __m512d g = _mm512_mul_pd(_mm512_set1_pd(3),r);
+    return _mm512_add_pd(_mm512_mul_pd(w,_mm512_mul_pd(d2,r)),_mm512_mul_pd(g,dot));
+}
+
+XCUBE_AVX512 static void vgh_avx512(const double *p, const double *cx, const double *cy, const double *cz, int n,
+                                   double *K, double *G, double *H){
+
+    const __m512d px = _mm512_set1_pd(p[0]), py = _mm512_set1_pd(p[1]), pz = _mm512_set1_pd(p[2]);
+    const __m512d three = _mm512_set1_pd(3), eps = _mm512_set1_pd(r_eps);
+    int i = 0;
+    for(;i+8<=n;i+=8){
+        __m512d dx = _mm512_sub_pd(px,_mm512_loadu_pd(cx+i));
+        __m512d dy = _mm512_sub_pd(py,_mm512_loadu_pd(cy+i));
+        __m512d dz = _mm512_sub_pd(pz,_mm512_loadu_pd(cz+i));
+        __m512d d2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx,dx),_mm512_mul_pd(dy,dy)),_mm512_mul_pd(dz,dz));
+        __m512d r = _mm512_sqrt_pd(d2);
+        __m512d t = _mm512_mul_pd(three,r);
+        _mm512_storeu_pd(K+i,_mm512_mul_pd(d2,r));
+        _mm512_storeu_pd(G+i,_mm512_mul_pd(t,dx));
+        _mm512_storeu_pd(G+i+n,_mm512_mul_pd(t,dy));
+        _mm512_storeu_pd(G+i+n*2,_mm512_mul_pd(t,dz));
+        __mmask8 mask = _mm512_cmp_pd_mask(r,eps,_CMP_GE_OQ);
+        __m512d s = _mm512_div_pd(three,r);
+        __m512d sx = _mm512_mul_pd(s,dx), sy = _mm512_mul_pd(s,dy), sz = _mm512_mul_pd(s,dz);
+        _mm512_storeu_pd(H+i,_mm512_maskz_mov_pd(mask,_mm512_add_pd(_mm512_mul_pd(sx,dx),t)));
+        _mm512_storeu_pd(H+i+n,_mm512_maskz_mov_pd(mask,_mm512_mul_pd(sx,dy)));
+        _mm512_storeu_pd(H+i+n*2,_mm512_maskz_mov_pd(mask,_mm512_mul_pd(sx,dz)));
+        _mm512_storeu_pd(H+i+n*3,_mm512_maskz_mov_pd(mask,_mm512_add_pd(_mm512_mul_pd(sy,dy),t)));
+        _mm512_storeu_pd(H+i+n*4,_mm512_maskz_mov_pd(mask,_mm512_mul_pd(sy,dz)));
+        _mm512_storeu_pd(H+i+n*5,_mm512_maskz_mov_pd(mask,_mm512_add_pd(_mm512_mul_pd(sz,dz),t)));
+    }
+    for(;i<n;++i)vgh_scalar(p,cx,cy,cz,i,n,K,G,H);
+}
+
+XCUBE_AVX512 static double contract_avx512(const double *p, const double *cx, const double *cy, const double *cz,
+                                          const double *w, const double *ux, const double *uy, const double *uz, int n){
+
+    const __m512d px = _mm512_set1_pd(p[0]), py = _mm512_set1_pd(p[1]), pz = _mm512_set1_pd(p[2]);
+    __m512d acc0 = _mm512_setzero_pd();
+    for(int i=0;i<n;i+=Width){
+        acc0 = _mm512_add_pd(acc0,term_avx512(px,py,pz,_mm512_loadu_pd(cx+i),_mm512_loadu_pd(cy+i),_mm512_loadu_pd(cz+i),
+                                              _mm512_loadu_pd(w+i),_mm512_loadu_pd(ux+i),_mm512_loadu_pd(uy+i),_mm512_loadu_pd(uz+i)));
+    }
+    double acc[Width];
+    _mm512_storeu_pd(acc,acc0);
+    return fold(acc);
+}
+
+XCUBE_AVX512 static inline void termGradient_avx512(__m512d px, __m512d py, __m512d pz, const double *cx, const double *cy, const double *cz,
+                                              const double *w, const double *ux, const double *uy, const double *uz, __m512d *acc){
+
+    const __m512d three = _mm512_set1_pd(3), eps = _mm512_set1_pd(r_eps);
+    __m512d vux = _mm512_loadu_pd(ux), vuy = _mm512_loadu_pd(uy), vuz = _mm512_loadu_pd(uz), vw = _mm512_loadu_pd(w);
+    __m512d dx = _mm512_sub_pd(px,_mm512_loadu_pd(cx)), dy = _mm512_sub_pd(py,_mm512_loadu_pd(cy)), dz = _mm512_sub_pd(pz,_mm512_loadu_pd(cz));
+    __m512d d2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx,dx),_mm512_mul_pd(dy,dy)),_mm512_mul_pd(dz,dz));
+    __m512d r = _mm512_sqrt_pd(d2);
+    __m512d g = _mm512_mul_pd(three,r);
+    __mmask8 mask = _mm512_cmp_pd_mask(r,eps,_CMP_GE_OQ);
+    __m512d h = _mm512_maskz_mov_pd(mask,_mm512_div_pd(three,r));
+    __m512d du = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(vux,dx),_mm512_mul_pd(vuy,dy)),_mm512_mul_pd(vuz,dz));
+    acc[0] = _mm512_add_pd(acc[0],_mm512_add_pd(_mm512_mul_pd(vw,_mm512_mul_pd(d2,r)),_mm512_mul_pd(g,du)));
+    __m512d s = _mm512_add_pd(_mm512_mul_pd(vw,g),_mm512_mul_pd(h,du));
+    acc[1] = _mm512_add_pd(acc[1],_mm512_add_pd(_mm512_mul_pd(s,dx),_mm512_mul_pd(g,vux)));
+    acc[2] = _mm512_add_pd(acc[2],_mm512_add_pd(_mm512_mul_pd(s,dy),_mm512_mul_pd(g,vuy)));
+    acc[3] = _mm512_add_pd(acc[3],_mm512_add_pd(_mm512_mul_pd(s,dz),_mm512_mul_pd(g,vuz)));
+}
+
+XCUBE_AVX512 static double contractGradient_avx512(const double *p, const double *cx, const double *cy, const double *cz,
+                                             const double *w, const double *ux, const double *uy, const double *uz, int n, double *grad){
+
+    const __m512d px = _mm512_set1_pd(p[0]), py = _mm512_set1_pd(p[1]), pz = _mm512_set1_pd(p[2]);
+    __m512d acc[1][4];
+    for(int hh=0;hh<1;++hh)for(int k=0;k<4;++k)acc[hh][k] = _mm512_setzero_pd();
+    for(int i=0;i<n;i+=Width)for(int hh=0;hh<1;++hh){
+        int o = i+hh*8;
+        termGradient_avx512(px,py,pz,cx+o,cy+o,cz+o,w+o,ux+o,uy+o,uz+o,acc[hh]);
+    }
+    double lanes[4][Width];
+    for(int k=0;k<4;++k)for(int hh=0;hh<1;++hh)_mm512_storeu_pd(lanes[k]+hh*8,acc[hh][k]);
+    for(int k=0;k<3;++k)grad[k] += fold(lanes[k+1]);
+    return fold(lanes[0]);
+}
+
+XCUBE_AVX512 static void contractBlock_avx512(const double *qx, const double *qy, const double *qz, int nq,
+                                             const double *cx, const double *cy, const double *cz,
+                                             const double *w, const double *ux, const double *uy, const double *uz, int n, double *acc){
+
+    for(int i=0;i<n;++i){
+        const __m512d x = _mm512_set1_pd(cx[i]), y = _mm512_set1_pd(cy[i]), z = _mm512_set1_pd(cz[i]);
+        const __m512d wi = _mm512_set1_pd(w[i]), u0 = _mm512_set1_pd(ux[i]), u1 = _mm512_set1_pd(uy[i]), u2 = _mm512_set1_pd(uz[i]);
+        for(int j=0;j<nq;j+=8){
+            __m512d t = term_avx512(_mm512_loadu_pd(qx+j),_mm512_loadu_pd(qy+j),_mm512_loadu_pd(qz+j),x,y,z,wi,u0,u1,u2);
+            _mm512_storeu_pd(acc+j,_mm512_add_pd(_mm512_loadu_pd(acc+j),t));
+        }
+    }
+}
+
+#endif
+
+
+/*************************************************************/
+
+void valueGradHessian(const double *p, const double *cx, const double *cy, const double *cz, int n,
+                      double *K, double *G, double *H){
+#ifdef XCUBE_SIMD_X86
+    if(s_level==AVX512)return vgh_avx512(p,cx,cy,cz,n,K,G,H);
+    if(s_level==AVX2)return vgh_avx2(p,cx,cy,cz,n,K,G,H);
+#endif
+    for(int i=0;i<n;++i)vgh_scalar(p,cx,cy,cz,i,n,K,G,H);
+}
+
+double contract(const double *p, const double *cx, const double *cy, const double *cz,
+                const double *w, const double *ux, const double *uy, const double *uz, int n){
+#ifdef XCUBE_SIMD_X86
+    if(s_level==AVX512)return contract_avx512(p,cx,cy,cz,w,ux,uy,uz,n);
+    if(s_level==AVX2)return contract_avx2(p,cx,cy,cz,w,ux,uy,uz,n);
+#endif
+    return contract_scalar(p,cx,cy,cz,w,ux,uy,uz,n);
+}
+
+double contractGradient(const double *p, const double *cx, const double *cy, const double *cz,
+                        const double *w, const double *ux, const double *uy, const double *uz, int n, double *grad){
+#ifdef XCUBE_SIMD_X86
+    if(s_level==AVX512)return contractGradient_avx512(p,cx,cy,cz,w,ux,uy,uz,n,grad);
+    if(s_level==AVX2)return contractGradient_avx2(p,cx,cy,cz,w,ux,uy,uz,n,grad);
+#endif
+    return contractGradient_scalar(p,cx,cy,cz,w,ux,uy,uz,n,grad);
+}
+
+void contractBlock(const double *qx, const double *qy, const double *qz, int nq,
+                   const double *cx, const double *cy, const double *cz,
+                   const double *w, const double *ux, const double *uy, const double *uz, int n, double *acc){
+#ifdef XCUBE_SIMD_X86
+    if(s_level==AVX512)return contractBlock_avx512(qx,qy,qz,nq,cx,cy,cz,w,ux,uy,uz,n,acc);
+    if(s_level==AVX2)return contractBlock_avx2(qx,qy,qz,nq,cx,cy,cz,w,ux,uy,uz,n,acc);
+#endif
+    contractBlock_scalar(qx,qy,qz,nq,cx,cy,cz,w,ux,uy,uz,n,acc);
+}
+
+}
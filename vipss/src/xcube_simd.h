@@ -0,0 +1,55 @@
+#ifndef XCUBE_SIMD_H
+#define XCUBE_SIMD_H
+
+
+#include <vector>
+using namespace std;
+
+
+//the triharmonic kernel phi(r) = r^3 and its derivatives, for one point against many centers
+//stored as separate x, y, z arrays. There are AVX-512 (8 centers), AVX2 (4 centers) and scalar
+//versions, chosen at runtime. All of them do the same operations in the same order (no FMA,
+//the same partial sums), so their results are bitwise identical
+namespace XCubeSIMD{
+
+enum Level{
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+//number of partial sums of contract, arrays passed to contract are padded to a multiple of it
+const int Width = 8;
+
+int level();
+void setLevel(int l);   //clamped to what the cpu supports
+const char *levelName();
+
+inline int padded(int n){return (n + Width - 1) / Width * Width;}
+
+//for centers i in [0,n), with d = p - c_i and r = |d|:
+//K[i] = r^3, G[i+k*n] = 3 r d_k (the gradient in p), H[i+k*n] = 3 d_a d_b / r + 3 r [a==b] for
+//k = xx, xy, xz, yy, yz, zz (0 for r < 1e-8)
+void valueGradHessian(const double *p, const double *cx, const double *cy, const double *cz, int n,
+                      double *K, double *G, double *H);
+
+//sum_i w_i r_i^3 + 3 r_i <u_i, d_i> = sum_i w_i phi + <u_i, grad phi>, n a multiple of Width
+//(padding with w = u = 0 adds nothing)
+double contract(const double *p, const double *cx, const double *cy, const double *cz,
+                const double *w, const double *ux, const double *uy, const double *uz, int n);
+
+//contract, and its gradient in p added to grad (hess phi is taken as 0 for r < 1e-8)
+double contractGradient(const double *p, const double *cx, const double *cy, const double *cz,
+                        const double *w, const double *ux, const double *uy, const double *uz, int n, double *grad);
+
+//acc[j] += contract of query j, for nq queries (a multiple of Width) given by qx, qy, qz; each
+//center is broadcast against the queries, so every query is summed in center order
+void contractBlock(const double *qx, const double *qy, const double *qz, int nq,
+                   const double *cx, const double *cy, const double *cz,
+                   const double *w, const double *ux, const double *uy, const double *uz, int n, double *acc);
+
+}
+
+
+
+#endif // XCUBE_SIMD_H